@@ -0,0 +1,39 @@
+#!/bin/bash
+# Compares a loop of ITERATIONS iterations with the unrolled script running
+# the same commands: the loop is nested "for" loops over ten words each.
+# The body is an external command, so every iteration forks; BODY=true runs
+# the builtin instead and measures the loop itself.
+MAIN=${MAIN:-./solution}
+ITERATIONS=${1:-100000}
+BODY=${BODY:-/bin/true}
+LOOP=$(mktemp)
+UNROLLED=$(mktemp)
+trap 'rm -f $LOOP $UNROLLED' EXIT
+
+levels=0
+for ((n = 1; n < ITERATIONS; n *= 10)); do
+    levels=$((levels + 1))
+done
+iterations=$((10 ** levels))
+
+for ((i = 0; i < levels; ++i)); do
+    echo "for v$i in 0 1 2 3 4 5 6 7 8 9; do" >> $LOOP
+done
+echo "$BODY" >> $LOOP
+for ((i = 0; i < levels; ++i)); do
+    echo "done" >> $LOOP
+done
+yes "$BODY" | head -n $iterations > $UNROLLED
+
+for script in $LOOP $UNROLLED; do
+    if [ $script == $LOOP ]; then
+        name="loop"
+    else
+        name="unrolled"
+    fi
+    start=$(date +%s%N)
+    $MAIN < $script > /dev/null
+    end=$(date +%s%N)
+    printf "%-8s %8d iterations, %9d bytes of script: %d ms\n" $name $iterations \
+           $(stat -c %s $script) $(((end - start) / 1000000))
+done
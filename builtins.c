@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <string.h>
+#include "builtins.h"
+#include "expander.h"
+#include "variables.h"
+
+static int
+builtin_export(char **argv, struct VariableTable *variables, FILE *out);
+// "export NAME[=value]...": the variables are passed to the commands started later
+
+static int
+builtin_echo(char **argv, struct VariableTable *variables, FILE *out);
+// "echo [-n] WORDS...": writes the words separated by spaces, "-n" drops the newline
+
+static int
+builtin_true(char **argv, struct VariableTable *variables, FILE *out);
+
+static int
+builtin_wait(char **argv, struct VariableTable *variables, FILE *out);
+// "wait": the shell waits for every job by itself, with --parallel the statements after it
+// start when all the ones before it are over
+
+static int
+builtin_false(char **argv, struct VariableTable *variables, FILE *out);
+
+static const struct Builtin builtins[] =
+{
+    {"export", builtin_export, 0},
+    {"echo", builtin_echo, 1},
+    {"true", builtin_true, 1},
+    {"false", builtin_false, 1},
+    {"wait", builtin_wait, 1}
+};
+
+static int
+builtin_echo(char **argv, struct VariableTable *variables, FILE *out)
+{
+    int newline = 1;
+    if (argv[1] != NULL && strcmp(argv[1], "-n") == 0) {
+        newline = 0;
+        ++argv;
+    }
+    for (char **word = argv + 1; *word != NULL; ++word) {
+        if (word != argv + 1) {
+            putc(' ', out);
+        }
+        fputs(*word, out);
+    }
+    if (newline) {
+        putc('\n', out);
+    }
+    return ferror(out) ? 1 : 0;
+}
+
+static int
+builtin_true(char **argv, struct VariableTable *variables, FILE *out)
+{
+    return 0;
+}
+
+static int
+builtin_false(char **argv, struct VariableTable *variables, FILE *out)
+{
+    return 1;
+}
+
+static int
+builtin_wait(char **argv, struct VariableTable *variables, FILE *out)
+{
+    return 0;
+}
+
+static int
+builtin_export(char **argv, struct VariableTable *variables, FILE *out)
+{
+    int status = 0;
+    for (++argv; *argv != NULL; ++argv) {
+        size_t len = assignment_name_len(*argv);
+        int ret;
+        if (len > 0) {
+            ret = variable_set(variables, *argv, len, *argv + len + 1, 1);
+        } else if ((len = variable_name_len(*argv)) > 0 && (*argv)[len] == '\0') {
+            ret = variable_export(variables, *argv, len);
+        } else {
+            fprintf(stderr, "export: %s: not a valid identifier\n", *argv);
+            status = 1;
+            continue;
+        }
+        if (ret < 0) {
+            perror("export");
+            return 1;
+        }
+    }
+    return status;
+}
+
+const struct Builtin *
+find_builtin(const char *name)
+{
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); ++i) {
+        if (strcmp(builtins[i].name, name) == 0) {
+            return &builtins[i];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,23 @@
+#ifndef SHELL_BUILTINS_H
+#define SHELL_BUILTINS_H
+
+#include <stdio.h>
+
+struct VariableTable;
+
+typedef int (*builtin_func)(char **argv, struct VariableTable *variables, FILE *out);
+// a command run by the shell itself, argv is NULL-terminated, returns the exit code
+
+struct Builtin
+{
+    const char *name;
+    builtin_func func;
+    int pure;
+};
+// a pure builtin changes nothing but its output, so "$(...)" may run it without a fork
+
+const struct Builtin *
+find_builtin(const char *name);
+// returns the builtin with the given name, NULL if there's none
+
+#endif
@@ -0,0 +1,183 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/sched.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "cgroup.h"
+#include "collector.h"
+
+enum
+{
+    CPU_PERIOD = 100000,
+    STAT_SIZE = 1 << 12,
+    REMOVE_TRIES = 100,
+    REMOVE_DELAY = 1000
+};
+// cpu.max is written as the quota per CPU_PERIOD microseconds, a killed leaf is busy until
+// its processes are gone, so its removal is tried again every REMOVE_DELAY microseconds
+
+static int
+write_file(int dir_fd, const char *name, const char *value);
+// writes the value into the control file of the cgroup, returns 0 or -1
+
+static ssize_t
+read_file(int dir_fd, const char *name, char *buf, size_t size);
+// reads the control file into the null-terminated buffer, returns its length or -1
+
+static int
+write_file(int dir_fd, const char *name, const char *value)
+{
+    int fd = openat(dir_fd, name, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    int ret = write_all(fd, value, strlen(value));
+    close(fd);
+    return ret;
+}
+
+static ssize_t
+read_file(int dir_fd, const char *name, char *buf, size_t size)
+{
+    int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t got = read(fd, buf, size - 1);
+    close(fd);
+    if (got >= 0) {
+        buf[got] = '\0';
+    }
+    return got;
+}
+
+int
+job_limits_set(const struct JobLimits *limits)
+{
+    return ((limits->memory) ? LIMIT_MEMORY : 0) | ((limits->cpu > 0) ? LIMIT_CPU : 0) |
+           ((limits->pids) ? LIMIT_PIDS : 0);
+}
+
+void
+cgroup_prepare(const char *parent)
+{
+    int dir_fd = open(parent, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0) {
+        // each controller is enabled on its own, so that a missing one doesn't stop the rest
+        write_file(dir_fd, "cgroup.subtree_control", "+memory");
+        write_file(dir_fd, "cgroup.subtree_control", "+cpu");
+        write_file(dir_fd, "cgroup.subtree_control", "+pids");
+        close(dir_fd);
+    }
+}
+
+int
+cgroup_create(const char *parent, const char *name, const struct JobLimits *limits, struct JobCgroup *group)
+{
+    group->dir_fd = -1;
+    group->applied = 0;
+    if (asprintf(&group->path, "%s/%s", parent, name) < 0) {
+        group->path = NULL;
+        return -1;
+    }
+    if (mkdir(group->path, 0755) < 0 ||
+        (group->dir_fd = open(group->path, O_PATH | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        rmdir(group->path);
+        free(group->path);
+        group->path = NULL;
+        return -1;
+    }
+    char value[64];
+    if (limits->memory) {
+        snprintf(value, sizeof(value), "%zu", limits->memory);
+        group->applied |= (write_file(group->dir_fd, "memory.max", value) == 0) ? LIMIT_MEMORY : 0;
+    }
+    if (limits->cpu > 0) {
+        snprintf(value, sizeof(value), "%lld %d", (long long) (limits->cpu * CPU_PERIOD), CPU_PERIOD);
+        group->applied |= (write_file(group->dir_fd, "cpu.max", value) == 0) ? LIMIT_CPU : 0;
+    }
+    if (limits->pids) {
+        snprintf(value, sizeof(value), "%lld", limits->pids);
+        group->applied |= (write_file(group->dir_fd, "pids.max", value) == 0) ? LIMIT_PIDS : 0;
+    }
+    return 0;
+}
+
+pid_t
+cgroup_fork(struct JobCgroup *group)
+{
+    struct clone_args args = {
+        .flags = CLONE_INTO_CGROUP,
+        .exit_signal = SIGCHLD,
+        .cgroup = group->dir_fd
+    };
+    pid_t pid = syscall(SYS_clone3, &args, sizeof(args));
+    // a kernel older than 5.7 has no clone3 or doesn't know the flag
+    if (pid >= 0 || (errno != ENOSYS && errno != E2BIG && errno != EINVAL)) {
+        return pid;
+    }
+    if ((pid = fork()) == 0 && write_file(group->dir_fd, "cgroup.procs", "0") < 0) {
+        perror("cgroup.procs");
+    }
+    return pid;
+}
+
+void
+apply_rlimits(const struct JobLimits *limits, int skip)
+{
+    /*
+     * Only the memory has a resource limit to fall back to: cpu.max limits the share of the CPU,
+     * and RLIMIT_NPROC counts all the processes of the user rather than the ones of the job.
+     * RLIMIT_AS limits the address space, which is more than the memory the job uses.
+     */
+    if (limits->memory && !(skip & LIMIT_MEMORY)) {
+        struct rlimit limit = {.rlim_cur = limits->memory, .rlim_max = limits->memory};
+        if (setrlimit(RLIMIT_AS, &limit) < 0) {
+            perror("setrlimit");
+        }
+    }
+}
+
+void
+cgroup_usage(const struct JobCgroup *group, unsigned long long *memory, unsigned long long *cpu_usec)
+{
+    char buf[STAT_SIZE];
+    if (read_file(group->dir_fd, "memory.peak", buf, sizeof(buf)) > 0) {
+        *memory = strtoull(buf, NULL, 10);
+    }
+    if (read_file(group->dir_fd, "cpu.stat", buf, sizeof(buf)) > 0) {
+        const char *usage = strstr(buf, "usage_usec ");
+        if (usage != NULL) {
+            *cpu_usec = strtoull(usage + strlen("usage_usec "), NULL, 10);
+        }
+    }
+}
+
+int
+cgroup_remove(struct JobCgroup *group)
+{
+    int ret = 0;
+    if (group->dir_fd >= 0) {
+        // the processes left in the leaf, like the background ones, are killed with it
+        write_file(group->dir_fd, "cgroup.kill", "1");
+        close(group->dir_fd);
+        int tries = 0;
+        while ((ret = rmdir(group->path)) < 0 && errno == EBUSY && tries++ < REMOVE_TRIES) {
+            usleep(REMOVE_DELAY);
+        }
+        if (ret < 0) {
+            perror(group->path);
+        }
+    }
+    free(group->path);
+    group->dir_fd = -1;
+    group->path = NULL;
+    return ret;
+}
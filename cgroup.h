@@ -0,0 +1,64 @@
+#ifndef SHELL_CGROUP_H
+#define SHELL_CGROUP_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+enum JobLimit
+{
+    LIMIT_MEMORY = 0x01,
+    LIMIT_CPU = 0x02,
+    LIMIT_PIDS = 0x04
+};
+
+struct JobLimits
+{
+    size_t memory;
+    double cpu;
+    long long pids;
+};
+// memory in bytes, cpu in CPUs (0.5 is half of one), pids in processes, 0 means no limit
+
+struct JobCgroup
+{
+    int dir_fd;
+    char *path;
+    int applied;
+};
+/*
+ * The cgroup v2 leaf of one job.
+ * dir_fd: the directory of the cgroup, -1 if the job runs without one
+ * applied: the JobLimit bits written to the cgroup, the rest is left to apply_rlimits
+ */
+
+int
+job_limits_set(const struct JobLimits *limits);
+// returns the JobLimit bits of the limits that are set
+
+void
+cgroup_prepare(const char *parent);
+// enables the memory, cpu and pids controllers for the children of the parent
+
+int
+cgroup_create(const char *parent, const char *name, const struct JobLimits *limits, struct JobCgroup *group);
+// creates the leaf under the parent and writes the limits into it, returns 0 or -1 if there's no leaf
+
+pid_t
+cgroup_fork(struct JobCgroup *group);
+// starts the child right in the leaf with clone3, on a kernel without it the child is forked
+// and moves itself there, returns like fork (-1 if the leaf can't take the child)
+
+void
+apply_rlimits(const struct JobLimits *limits, int skip);
+// sets the resource limits of the current process for the limits without the skip bits,
+// only the memory can be limited this way (by the address space)
+
+void
+cgroup_usage(const struct JobCgroup *group, unsigned long long *memory, unsigned long long *cpu_usec);
+// reads the peak memory in bytes and the CPU time of the leaf, leaves the values if they can't be read
+
+int
+cgroup_remove(struct JobCgroup *group);
+// kills what is left in the leaf and removes it, returns 0 or -1 if it can't be removed
+
+#endif
@@ -0,0 +1,162 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include "collector.h"
+
+enum
+{
+    READ_SIZE = 1 << 16,
+    INIT_CAPACITY = 1 << 12
+};
+
+static int
+open_spill_file(void);
+// creates an unlinked temporary file in $TMPDIR or /tmp
+
+static int
+open_spill_file(void)
+{
+    const char *dir = getenv("TMPDIR");
+    if (dir == NULL || !*dir) {
+        dir = "/tmp";
+    }
+    int fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd >= 0 || (errno != EOPNOTSUPP && errno != EISDIR)) {
+        return fd;
+    }
+    // the file system can't make unnamed files, so the file is unlinked right after creating
+    char *path;
+    if (asprintf(&path, "%s/jshell-XXXXXX", dir) < 0) {
+        return -1;
+    }
+    fd = mkostemp(path, O_CLOEXEC);
+    if (fd >= 0) {
+        unlink(path);
+    }
+    free(path);
+    return fd;
+}
+
+int
+write_all(int fd, const char *buf, size_t size)
+{
+    while (size > 0) {
+        ssize_t written = write(fd, buf, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += written;
+        size -= written;
+    }
+    return 0;
+}
+
+void
+collector_init(struct OutputCollector *collector, int fd, size_t limit)
+{
+    collector->fd = fd;
+    collector->data = NULL;
+    collector->size = collector->capacity = 0;
+    collector->limit = limit;
+    collector->spill_fd = -1;
+}
+
+int
+collector_read(struct OutputCollector *collector)
+{
+    char buf[READ_SIZE];
+    ssize_t got = read(collector->fd, buf, sizeof(buf));
+    if (got < 0) {
+        return (errno == EINTR || errno == EAGAIN) ? 1 : -1;
+    }
+    if (got == 0) {
+        close(collector->fd);
+        collector->fd = -1;
+        return 0;
+    }
+    size_t in_memory = 0;
+    if (collector->spill_fd < 0 && collector->size < collector->limit) {
+        in_memory = collector->limit - collector->size;
+        if (in_memory > (size_t) got) {
+            in_memory = got;
+        }
+        if (collector->size + in_memory > collector->capacity) {
+            size_t capacity = (collector->capacity) ? collector->capacity : INIT_CAPACITY;
+            while (capacity < collector->size + in_memory) {
+                capacity <<= 1;
+            }
+            char *data = realloc(collector->data, capacity);
+            if (data == NULL) {
+                return -1;
+            }
+            collector->data = data;
+            collector->capacity = capacity;
+        }
+        memcpy(collector->data + collector->size, buf, in_memory);
+        collector->size += in_memory;
+    }
+    if (in_memory < (size_t) got) {
+        if (collector->spill_fd < 0 && (collector->spill_fd = open_spill_file()) < 0) {
+            return -1;
+        }
+        if (write_all(collector->spill_fd, buf + in_memory, got - in_memory) < 0) {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+int
+collector_flush(struct OutputCollector *collector, int out_fd)
+{
+    if (write_all(out_fd, collector->data, collector->size) < 0) {
+        return -1;
+    }
+    collector->size = 0;
+    if (collector->spill_fd >= 0) {
+        off_t offset = 0, end = lseek(collector->spill_fd, 0, SEEK_CUR);
+        while (offset < end) {
+            ssize_t sent = sendfile(out_fd, collector->spill_fd, &offset, end - offset);
+            if (sent < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                // sendfile can't write to this kind of descriptor (appending files, for instance)
+                char buf[READ_SIZE];
+                ssize_t got = pread(collector->spill_fd, buf, sizeof(buf), offset);
+                if (got <= 0 || write_all(out_fd, buf, got) < 0) {
+                    return -1;
+                }
+                offset += got;
+            } else if (sent < 0 && errno != EINTR) {
+                return -1;
+            } else if (sent == 0) {
+                break;
+            }
+        }
+        close(collector->spill_fd);
+        collector->spill_fd = -1;
+    }
+    return 0;
+}
+
+void
+collector_free(struct OutputCollector *collector)
+{
+    if (collector->fd >= 0) {
+        close(collector->fd);
+        collector->fd = -1;
+    }
+    if (collector->spill_fd >= 0) {
+        close(collector->spill_fd);
+        collector->spill_fd = -1;
+    }
+    free(collector->data);
+    collector->data = NULL;
+    collector->size = collector->capacity = 0;
+}
@@ -0,0 +1,45 @@
+#ifndef SHELL_COLLECTOR_H
+#define SHELL_COLLECTOR_H
+
+#include <stddef.h>
+
+struct OutputCollector
+{
+    int fd;
+    char *data;
+    size_t size;
+    size_t capacity;
+    size_t limit;
+    int spill_fd;
+};
+/*
+ * Keeps the output of one job until it can be written out as a whole.
+ * fd: the read end of the job's pipe, -1 after the end of file
+ * data, size, capacity: the beginning of the output, kept in memory
+ * limit: at most this many bytes are kept in memory, the rest goes to spill_fd
+ * spill_fd: an unlinked temporary file, -1 while the output fits into memory
+ */
+
+void
+collector_init(struct OutputCollector *collector, int fd, size_t limit);
+// starts collecting the output read from the fd
+
+int
+collector_read(struct OutputCollector *collector);
+// reads the data available in the pipe, returns 1 if more can come,
+// 0 at the end of file (the fd is closed then) or -1 on error
+
+int
+collector_flush(struct OutputCollector *collector, int out_fd);
+// writes the whole collected output to out_fd and drops it,
+// returns 0 or -1 on error
+
+void
+collector_free(struct OutputCollector *collector);
+// closes the descriptors and frees up the memory of the collector
+
+int
+write_all(int fd, const char *buf, size_t size);
+// writes the whole buffer, returns 0 or -1 on error
+
+#endif
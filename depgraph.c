@@ -0,0 +1,150 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "depgraph.h"
+#include "hash.h"
+
+enum
+{
+    INIT_FILES = 64,
+    INIT_LIST = 4
+};
+
+static struct FileAccess *
+find_file(struct FileAccess *files, size_t capacity, const char *key);
+// returns the slot of the file or the empty slot where it would be placed
+
+static int
+grow_files(struct DependencyGraph *graph);
+// doubles the capacity of the table, keeping it at most half full
+
+static int
+append_index(size_t **list, size_t *count, size_t *capacity, size_t index);
+
+static int
+add_edge(struct DependencyGraph *graph, size_t from, size_t to);
+// makes the statement wait for the earlier one, once for every pair
+
+static struct FileAccess *
+find_file(struct FileAccess *files, size_t capacity, const char *key)
+{
+    size_t idx = hash_bytes(key, strlen(key)) & (capacity - 1);
+    while (files[idx].key != NULL && strcmp(files[idx].key, key) != 0) {
+        idx = (idx + 1) & (capacity - 1);
+    }
+    return &files[idx];
+}
+
+static int
+grow_files(struct DependencyGraph *graph)
+{
+    size_t capacity = (graph->file_capacity) ? graph->file_capacity << 1 : INIT_FILES;
+    struct FileAccess *files = calloc(capacity, sizeof(*files));
+    if (files == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < graph->file_capacity; ++i) {
+        if (graph->files[i].key != NULL) {
+            *find_file(files, capacity, graph->files[i].key) = graph->files[i];
+        }
+    }
+    free(graph->files);
+    graph->files = files;
+    graph->file_capacity = capacity;
+    return 0;
+}
+
+static int
+append_index(size_t **list, size_t *count, size_t *capacity, size_t index)
+{
+    if (*count == *capacity) {
+        size_t new_capacity = (*capacity) ? *capacity << 1 : INIT_LIST;
+        size_t *tmp = realloc(*list, new_capacity * sizeof(*tmp));
+        if (tmp == NULL) {
+            return -1;
+        }
+        *list = tmp;
+        *capacity = new_capacity;
+    }
+    (*list)[(*count)++] = index;
+    return 0;
+}
+
+static int
+add_edge(struct DependencyGraph *graph, size_t from, size_t to)
+{
+    // the statements are added in order, so a repeated edge is the last one of the list
+    if (from == to || (graph->next_count[from] > 0 && graph->next[from][graph->next_count[from] - 1] == to)) {
+        return 0;
+    }
+    if (append_index(&graph->next[from], &graph->next_count[from], &graph->next_capacity[from], to) < 0) {
+        return -1;
+    }
+    ++graph->pending[to];
+    return 0;
+}
+
+int
+graph_init(struct DependencyGraph *graph, size_t count)
+{
+    memset(graph, 0, sizeof(*graph));
+    graph->count = count;
+    graph->pending = calloc(count + 1, sizeof(*graph->pending));
+    graph->next = calloc(count + 1, sizeof(*graph->next));
+    graph->next_count = calloc(count + 1, sizeof(*graph->next_count));
+    graph->next_capacity = calloc(count + 1, sizeof(*graph->next_capacity));
+    if (graph->pending == NULL || graph->next == NULL || graph->next_count == NULL ||
+        graph->next_capacity == NULL || grow_files(graph) < 0) {
+        graph_free(graph);
+        return -1;
+    }
+    return 0;
+}
+
+int
+graph_access(struct DependencyGraph *graph, size_t index, const char *key, int write)
+{
+    if ((graph->file_count + 1) * 2 > graph->file_capacity && grow_files(graph) < 0) {
+        return -1;
+    }
+    struct FileAccess *file = find_file(graph->files, graph->file_capacity, key);
+    if (file->key == NULL) {
+        if ((file->key = strdup(key)) == NULL) {
+            return -1;
+        }
+        file->writer = SIZE_MAX;
+        ++graph->file_count;
+    }
+    if (file->writer != SIZE_MAX && add_edge(graph, file->writer, index) < 0) {
+        return -1;
+    }
+    if (!write) {
+        return append_index(&file->readers, &file->reader_count, &file->reader_capacity, index);
+    }
+    for (size_t i = 0; i < file->reader_count; ++i) {
+        if (add_edge(graph, file->readers[i], index) < 0) {
+            return -1;
+        }
+    }
+    file->reader_count = 0;
+    file->writer = index;
+    return 0;
+}
+
+void
+graph_free(struct DependencyGraph *graph)
+{
+    for (size_t i = 0; graph->next != NULL && i < graph->count; ++i) {
+        free(graph->next[i]);
+    }
+    for (size_t i = 0; i < graph->file_capacity; ++i) {
+        free(graph->files[i].key);
+        free(graph->files[i].readers);
+    }
+    free(graph->pending);
+    free(graph->next);
+    free(graph->next_count);
+    free(graph->next_capacity);
+    free(graph->files);
+    memset(graph, 0, sizeof(*graph));
+}
@@ -0,0 +1,52 @@
+#ifndef SHELL_DEPGRAPH_H
+#define SHELL_DEPGRAPH_H
+
+#include <stddef.h>
+
+struct FileAccess
+{
+    char *key;
+    size_t writer;
+    size_t *readers;
+    size_t reader_count;
+    size_t reader_capacity;
+};
+/*
+ * The statements using one file so far.
+ * writer: the last statement that writes the file, SIZE_MAX if there's none
+ * readers: the statements that read the file after that
+ */
+
+struct DependencyGraph
+{
+    size_t count;
+    size_t *pending;
+    size_t **next;
+    size_t *next_count;
+    size_t *next_capacity;
+    struct FileAccess *files;
+    size_t file_count;
+    size_t file_capacity;
+};
+/*
+ * The order the statements of a list must keep between themselves.
+ * pending: the amount of the earlier statements each statement has to wait for
+ * next, next_count: the later statements waiting for each statement
+ * files: an open addressing table of the files used by the statements added so far
+ */
+
+int
+graph_init(struct DependencyGraph *graph, size_t count);
+// prepares the graph of count statements without dependencies, returns 0 or -1
+
+int
+graph_access(struct DependencyGraph *graph, size_t index, const char *key, int write);
+// adds the use of the file to the statement, the statements must be added in order:
+// a read waits for the last write of the file, a write waits for the last write and the reads after it,
+// returns 0 or -1
+
+void
+graph_free(struct DependencyGraph *graph);
+// frees up the memory of the graph
+
+#endif
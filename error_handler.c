@@ -2,6 +2,15 @@
 #include "syntax.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+static void (*exit_handler)(int code);
+
+void
+set_exit_handler(void (*handler)(int code))
+{
+    exit_handler = handler;
+}
 
 void
 set_error_number(struct SuperStorage *storage, enum ErrorCode code)
@@ -13,8 +22,8 @@ set_error_number(struct SuperStorage *storage, enum ErrorCode code)
     }
 }
 
-_Noreturn void
-raise_error(const char *error_string, enum ErrorCode ErrorCode)
+void
+print_error(const char *error_string, enum ErrorCode ErrorCode)
 {
     if (ErrorCode != SYSCALL_ERROR && ErrorCode != MEMORY_ERROR && ErrorCode != INTERNAL_ERROR) {
         fprintf(stderr, "Error while parsing: ");
@@ -29,12 +38,19 @@ raise_error(const char *error_string, enum ErrorCode ErrorCode)
     case NO_OPERATION:
         fprintf(stderr, "No operation between operands at: %s\n", error_string);
         break;
-    case INVALID_OPERATION:
-        fprintf(stderr, "Invalid operation %c\n", *error_string);
+    case INVALID_OPERATION: {
+        // "|%" is shown with the worker count it was rejected for
+        int len = strspn(error_string, "|%");
+        len += strspn(error_string + len, "0123456789");
+        fprintf(stderr, "Invalid operation %.*s\n", (len > 0) ? len : 1, error_string);
         break;
+    }
     case INVALID_OPERAND:
         fprintf(stderr, "Invalid operand at: %s\n", error_string);
         break;
+    case LOOP_BALANCE:
+        fprintf(stderr, "The loop is not closed properly at: %s\n", error_string);
+        break;
     case MEMORY_ERROR:
         fprintf(stderr, "Out of memory\n");
         break;
@@ -44,5 +60,14 @@ raise_error(const char *error_string, enum ErrorCode ErrorCode)
     default:
         break;
     }
+}
+
+_Noreturn void
+raise_error(const char *error_string, enum ErrorCode ErrorCode)
+{
+    print_error(error_string, ErrorCode);
+    if (exit_handler != NULL) {
+        exit_handler(ERROR_EXIT);
+    }
     exit(ERROR_EXIT);
-}
\ No newline at end of file
+}
@@ -9,9 +9,11 @@ enum ErrorCode
     NO_OPERATION = 0x03,
     INVALID_OPERATION = 0x04,
     INVALID_OPERAND = 0x05,
+    LOOP_BALANCE = 0x06,
     INTERNAL_ERROR = 0x07,
     MEMORY_ERROR = 0x08,
     SYSCALL_ERROR = 0x09,
+    TIMEOUT_EXIT = 0x7C,
     EXEC_ERROR = 0x7F,
     SIGNAL_ADD = 0x80
 };
@@ -25,6 +27,14 @@ struct ErrorContainer
 
 struct SuperStorage;
 
+void
+print_error(const char *error_string, enum ErrorCode ErrorCode);
+// prints the error message to stderr
+
+void
+set_exit_handler(void (*handler)(int code));
+// makes raise_error end the process through the handler, NULL brings back exit
+
 _Noreturn void
 raise_error(const char *error_string, enum ErrorCode ErrorCode);
 // prints the error message to stderr and terminates the process
@@ -1,21 +1,323 @@
+#define _GNU_SOURCE
+#include <stdint.h>
 #include <stdlib.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <poll.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <sys/prctl.h>
+#include <linux/ioprio.h>
 #include "executor.h"
+#include "builtins.h"
+#include "cgroup.h"
+#include "collector.h"
+#include "depgraph.h"
 #include "error_handler.h"
+#include "expander.h"
+#include "glob.h"
+#include "journal.h"
+#include "options.h"
 #include "syntax.h"
+#include "variables.h"
+
+enum
+{
+    INIT_SEQUENCE = 64,
+    INIT_BRANCHES = 16
+};
+// the initial amounts of statements kept by execute_sequence and of branches kept by execute_grouped
+
+enum
+{
+    TIMEOUT_KILL_DELAY = 1000,
+    TIMEOUT_POLL_INTERVAL = 10
+};
+// the milliseconds between TERM and KILL of a timed out job, and between the checks
+// of a timed job when the kernel can't give a descriptor to wait on it
+
+enum
+{
+    DEFAULT_GROUP_MEMORY = 1 << 20,
+    DEFAULT_MAP_CHUNK = 1 << 22,
+    SPLICE_SIZE = 1 << 16
+};
+
+struct MapJob
+{
+    pid_t pid;
+    int status;
+    struct OutputCollector out;
+};
+// a worker of "|%" running the command on one chunk of the input
+
+struct JobTimer
+{
+    pid_t pid;
+    int timer_fd;
+    int stage;
+};
+/*
+ * The timeout of a child, which leads its own process group.
+ * timer_fd: the timerfd armed when the child was started
+ * stage: 0 while the time isn't out, 1 after TERM is sent, 2 after KILL
+ */
+
+struct JobGroup
+{
+    pid_t pid;
+    struct JobCgroup cgroup;
+};
+// the cgroup leaf of a running child, removed when the child is waited for
+
+struct SharedCounters
+{
+    unsigned long jobs;
+};
+// shared by all the processes of one run, so that the jobs are numbered in the order they start
+
+struct ExecutionState
+{
+    const struct ExecutionConfig *config;
+    struct SharedCounters *shared;
+    struct VariableTable variables;
+    struct GlobCache globs;
+    pid_t runner;
+    int runner_nice;
+    struct JobTimer *timers;
+    size_t timer_count;
+    size_t timer_capacity;
+    struct JobGroup *groups;
+    size_t group_count;
+    size_t group_capacity;
+    unsigned long cgroup_count;
+    struct Journal journal;
+};
+// set up by run_tree, it lives only in the process running the tree and its children,
+// so the variables set by a child never reach the shell,
+// runner_nice is the niceness of the runner the niceness of the jobs is counted from
+
+static const struct ExecutionConfig default_config = {};
+
+static struct ExecutionState state = {.config = &default_config, .journal = {.fd = -1}};
+
+static _Noreturn void
+leave(int code);
+// ends a process running the tree through _exit after flushing stdout and stderr, so that neither
+// the parse tree nor the atexit handlers and streams of an embedding process are touched,
+// the shell removes the cgroup leaves of its children first
 
 static void
+close_descriptors(void);
+// closes all the descriptors but the standard ones right before exec
+
+static void
+remove_groups(void);
+// removes the cgroup leaves of all the running children
+
+static int
 execute(struct ExpressionTree *tree, struct SuperStorage *storage);
+// executes the tree in the current process and returns its exit code,
+// forks only for commands, pipelines, parallel runs and brackets
+
+static _Noreturn void
+execute_and_exit(struct ExpressionTree *tree, struct SuperStorage *storage);
+// used by forked children: a plain command replaces the child via exec,
+// any other tree is executed and the child leaves with its exit code
+
+static int
+execute_loop(struct ExpressionTree *tree, struct SuperStorage *storage);
+// runs the body of "while" or "for" in the current process, the tree is not parsed again
+
+static struct ExpressionTree **
+collect_statements(struct ExpressionTree *tree, size_t *count);
+// returns the statements separated by ";" and newlines in order,
+// the long left branch of a big script is walked without recursion
+
+static int
+execute_sequence(struct ExpressionTree *tree, struct SuperStorage *storage);
+// executes the statements separated by ";" and newlines one after another
+
+static int
+is_annotation(const char *word);
+// checks if the word is "@r:PATH" or "@w:PATH", which tells --parallel a file the command reads or writes,
+// such words between the assignments and the command are dropped
+
+static int
+execute_parallel(struct ExpressionTree **statements, size_t count, struct SuperStorage *storage);
+// runs the statements at once on the workers, each one after the earlier statements using its files,
+// their outputs are written in order and the exit code is the one of the last statement
+
+static char *
+file_key(const char *path);
+// names the file by the device and the inode of its directory, so that the different paths
+// to one file get the same name
+
+static void
+add_accesses(struct DependencyGraph *graph, size_t index, const struct ExpressionTree *tree);
+// adds the files read and written by the redirections and the annotations of the tree to the statement
+
+static int
+assignments_only(const struct ExpressionTree *tree);
+// checks if the words of the command are the assignments and the annotations only
+
+static int
+changes_shell(const struct ExpressionTree *tree);
+// checks if the statement sets the variables of the shell: assignments, "export" and loops
+// run in the shell's own process
+
+static void
+collect_files(const struct ExpressionTree *tree, struct WordList *files);
+// adds the redirection files of the tree with the variables substituted
+
+static int
+execute_journaled(struct ExpressionTree *tree, struct SuperStorage *storage);
+// executes the top-level statements, recording each one in the journal,
+// on resume the statements done by the previous runs are skipped
 
 static void
 check_redirection(struct ExpressionTree *tree);
 
+static char *
+redirection_file(const char *file);
+// the name of the redirection file with the variables substituted
+
+static void
+forget_created_files(const struct ExpressionTree *tree);
+// drops the cached listings of the directories the redirections of the tree may create
+// files in, called by the shell before the tree runs in a child
+
+static int
+start_expansion(struct ExpressionTree *tree, struct SuperStorage *storage, struct ExpandContext *context);
+// runs the "$(...)" of the command and prepares the context its words are expanded with,
+// returns the exit code of the last substitution, 0 if there are none
+
+static void
+end_expansion(struct ExpandContext *context);
+// frees up the outputs of the substitutions
+
+static char *
+capture_output(struct ExpressionTree *tree, struct SuperStorage *storage, int *status);
+// runs the list of "$(...)" and returns its output without the trailing newlines,
+// a pure builtin is run in the current process, anything else in a child
+
+static int
+expand_command(struct ExpressionTree *tree, struct SuperStorage *storage, struct WordList *words, size_t *assigns);
+// expands the words of the command, assigns is set to the amount of the leading "NAME=value" words,
+// returns the exit code of the last substitution
+
+static int
+execute_command(struct ExpressionTree *tree, struct SuperStorage *storage);
+// sets the variables of a command made of assignments only and runs the builtins
+// in the current process, any other command is run in a child
+
 static _Noreturn void
-end_process(int status);
+run_command(struct ExpressionTree *tree, struct WordList *words, size_t assigns);
+// used by forked children: the leading assignments are exported to the command only,
+// then it is run as a builtin or replaces the child via exec
+
+static void
+place_job(void);
+// applies the CPU affinity, niceness and I/O class to the branch of "&" being started
+
+static int
+places_own_branches(const struct ExpressionTree *tree);
+// checks that the branch is a "&", maybe in brackets, whose branches are placed by themselves
+
+static pid_t
+fork_job(struct ExpressionTree *tree, struct SuperStorage *storage, int in_fd, int out_fd);
+// starts a branch of "&" or a worker of "|%" in a child process, returns its pid,
+// the job reads from in_fd and writes to out_fd instead of stdin and stdout if they are not negative
+
+static int
+execute_map(struct ExpressionTree *tree, struct SuperStorage *storage);
+// runs the left command, splits its output by lines into chunks and runs
+// the right command on each of them, at most the chosen amount at once
+
+static int
+new_chunk(void);
+// creates the file the next chunk of the input of "|%" is gathered in
+
+static ssize_t
+fill_chunk(int in_fd, int chunk_fd, size_t size);
+// moves at most size bytes from the pipe to the end of the chunk, spliced if it's possible
+
+static off_t
+find_line_end(int fd, off_t from, off_t to);
+// returns the offset after the last newline of the file between from and to, -1 if there's none
+
+static size_t
+group_memory(void);
+// the bytes of a collected output kept in memory
+
+static int
+execute_grouped(struct ExpressionTree *tree, struct SuperStorage *storage);
+// runs all the branches of a "&" list at once, collecting the output of each one
+// and writing it out as a whole when the branch completes
+
+static int
+wait_process(pid_t pid);
+// waits for the given child and returns its exit code, TIMEOUT_EXIT if its time ran out
+
+static int
+timeout_prefix(const struct ExpressionTree *tree, long long *at, long long *timeout);
+// checks if the words of the command after the assignments start with "timeout DURATION",
+// sets the index of "timeout" and the duration if they do
+
+static long long
+job_timeout(const struct ExpressionTree *tree);
+// the milliseconds the child running the tree is given, 0 if it's not limited:
+// the "timeout" prefix of a command or --job-timeout for the jobs started by the shell itself
+
+static pid_t
+fork_child(const struct ExpressionTree *tree);
+// forks the child that will run the tree: a child of the shell itself gets its own cgroup leaf
+// or resource limits if they are asked for, and a timed child leads its own process group
+// so that the whole job is killed
+
+static void
+arm_timer(pid_t pid, long long timeout);
+// starts the timer of the child
+
+static void
+finish_job(pid_t pid, const struct rusage *usage);
+// removes the cgroup leaf of the waited child and prints its usage if it's asked for
+
+static void
+fire_timer(struct JobTimer *timer);
+// sends TERM to the timed out job and arms the timer for KILL, or sends KILL
+
+static nfds_t
+poll_timers(struct pollfd *fds, nfds_t count);
+// adds the timers of the running children to the polled descriptors, returns the new count
+
+static void
+check_timers(const struct pollfd *fds, nfds_t from, nfds_t to);
+// fires the timers that expired among the polled ones
+
+static int
+wait_readable(int fd, int timeout);
+// waits at most timeout milliseconds (-1 for no limit) until the descriptor can be read
+// while the timers of the running children go on, returns 1 if it can be read
+
+static char *
+redirection_file(const char *file)
+{
+    struct ExpandContext context = {.variables = &state.variables};
+    char *name = expand_string(file, &context);
+    if (name == NULL) {
+        raise_error(NULL, MEMORY_ERROR);
+    }
+    return name;
+}
 
 static void
 check_redirection(struct ExpressionTree *tree)
@@ -26,21 +328,27 @@ check_redirection(struct ExpressionTree *tree)
      */
     if (tree->redirect.need_redirect) {
         if (tree->redirect.out.exists && tree->redirect.out.file) {
-            int out = open(tree->redirect.out.file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            char *file = redirection_file(tree->redirect.out.file);
+            int out = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+            free(file);
             if (out < 0 || dup2(out, 1) < 0) {
                 raise_error(NULL, SYSCALL_ERROR);
             }
             close(out);
         }
         if (tree->redirect.append.exists && tree->redirect.append.file) {
-            int out = open(tree->redirect.append.file, O_WRONLY | O_CREAT | O_APPEND, 0666);
+            char *file = redirection_file(tree->redirect.append.file);
+            int out = open(file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+            free(file);
             if (out < 0 || dup2(out, 1) < 0) {
                 raise_error(NULL, SYSCALL_ERROR);
             }
             close(out);
         }
         if (tree->redirect.in.exists && tree->redirect.in.file) {
-            int in = open(tree->redirect.in.file, O_RDONLY);
+            char *file = redirection_file(tree->redirect.in.file);
+            int in = open(file, O_RDONLY | O_CLOEXEC);
+            free(file);
             if (in < 0 || dup2(in, 0) < 0) {
                 raise_error(NULL, SYSCALL_ERROR);
             }
@@ -50,142 +358,1474 @@ check_redirection(struct ExpressionTree *tree)
 }
 
 int
-start_execution(struct SuperStorage *storage)
+start_execution(struct SuperStorage *storage, const struct ExecutionConfig *config)
 {
     prctl(PR_SET_CHILD_SUBREAPER); // just for safety reasons
     pid_t pid;
     if ((pid = fork()) < 0) {
         raise_error(NULL, SYSCALL_ERROR);
     } else if (pid == 0) {
-        execute(storage->parsing_tree, storage);
+        leave(run_tree(storage, config));
     }
     int status;
     if (waitpid(pid, &status, 0) <= 0) {
         raise_error(NULL, INTERNAL_ERROR);
     }
     while (wait(NULL) > 0) {}
-    if (WIFEXITED(status)) {
-        return (WEXITSTATUS(status));
+    return end_process(status);
+}
+
+int
+run_tree(struct SuperStorage *storage, const struct ExecutionConfig *config)
+{
+    state.config = (config != NULL) ? config : &default_config;
+    const struct ExecutionConfig *conf = state.config;
+    if (conf->trace || conf->cpus != NULL || conf->nice || conf->ioprio_class) {
+        state.shared = mmap(NULL, sizeof(*state.shared), PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (state.shared == MAP_FAILED) {
+            raise_error(NULL, SYSCALL_ERROR);
+        }
+    }
+    state.runner = getpid();
+    errno = 0;
+    if ((state.runner_nice = getpriority(PRIO_PROCESS, 0)) == -1 && errno) {
+        state.runner_nice = 0;
+    }
+    set_exit_handler(leave);
+    if (conf->cgroup_parent != NULL) {
+        cgroup_prepare(conf->cgroup_parent);
+    }
+    if (variables_init(&state.variables, environ) < 0) {
+        raise_error(NULL, MEMORY_ERROR);
+    }
+    int status;
+    if (conf->journal != NULL) {
+        if (journal_open(&state.journal, conf->journal, conf->resume) < 0) {
+            raise_error(NULL, SYSCALL_ERROR);
+        }
+        status = execute_journaled(storage->parsing_tree, storage);
+        if (journal_close(&state.journal) < 0) {
+            perror(conf->journal);
+        }
     } else {
-        return (SIGNAL_ADD + WTERMSIG(status));
+        status = execute(storage->parsing_tree, storage);
+    }
+    if (state.shared != NULL) {
+        munmap(state.shared, sizeof(*state.shared));
+        state.shared = NULL;
+    }
+    variables_free(&state.variables);
+    glob_cache_free(&state.globs);
+    free(state.timers);
+    state.timers = NULL;
+    state.timer_count = state.timer_capacity = 0;
+    remove_groups();
+    free(state.groups);
+    state.groups = NULL;
+    state.group_capacity = 0;
+    set_exit_handler(NULL);
+    return status;
+}
+
+static void
+remove_groups(void)
+{
+    for (size_t i = 0; i < state.group_count; ++i) {
+        cgroup_remove(&state.groups[i].cgroup);
     }
+    state.group_count = 0;
 }
 
 static _Noreturn void
-end_process(int status)
+leave(int code)
 {
-    if (WIFEXITED(status)) {
-        exit(WEXITSTATUS(status));
-    } else {
-        exit(SIGNAL_ADD + WTERMSIG(status));
+    remove_groups();
+    if (state.config->journal != NULL && getpid() == state.runner) {
+        journal_close(&state.journal);
     }
+    fflush(stdout);
+    fflush(stderr);
+    _exit(code);
 }
 
 static void
-execute(struct ExpressionTree *tree, struct SuperStorage *storage)
+close_descriptors(void)
 {
-    if (tree == NULL) {
-        exit(0);
+#ifdef SYS_close_range
+    if (syscall(SYS_close_range, 3, ~0U, 0) == 0) {
+        return;
     }
-    int reverse = 0, status, fd[2];
-    pid_t pid1, pid2;
-    switch (tree->opcode) {
-    case OP_COM:
-        check_redirection(tree);
-        execvp(tree->argv[0], tree->argv);
-        perror(tree->argv[0]);
-        exit(EXEC_ERROR);
-    case OP_EOF:
-        exit(0);
-    case OP_DISJ:
-        reverse = 1;
-    case OP_CONJ:
-        if ((pid1 = fork()) < 0) {
-            raise_error(NULL, SYSCALL_ERROR);
-        } else if (pid1 == 0) {
-            execute(tree->left, storage);
+#endif
+    // a kernel older than 5.9 has no close_range
+    for (long fd = 3, max = sysconf(_SC_OPEN_MAX); fd < max; ++fd) {
+        close(fd);
+    }
+}
+
+static void
+place_job(void)
+{
+    const struct ExecutionConfig *conf = state.config;
+    if (state.shared == NULL) {
+        return;
+    }
+    unsigned long job = __atomic_fetch_add(&state.shared->jobs, 1, __ATOMIC_RELAXED);
+    int cpu = -1;
+    if (conf->cpus != NULL) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        cpu = conf->cpus[job % conf->cpu_count];
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+            perror("sched_setaffinity");
+            cpu = -1;
+        }
+    }
+    // the niceness is set rather than added, so a job nested in another one doesn't get it twice
+    if (conf->nice && setpriority(PRIO_PROCESS, 0, state.runner_nice + conf->nice) < 0) {
+        perror("setpriority");
+    }
+    if (conf->ioprio_class &&
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+                IOPRIO_PRIO_VALUE(conf->ioprio_class, conf->ioprio_level)) < 0) {
+        perror("ioprio_set");
+    }
+    if (conf->trace) {
+        char cpu_name[sizeof("any") + sizeof(int) * 3];
+        if (cpu < 0) {
+            snprintf(cpu_name, sizeof(cpu_name), "any");
+        } else {
+            snprintf(cpu_name, sizeof(cpu_name), "%d", cpu);
+        }
+        fprintf(stderr, "jshell: job %lu, pid %d: cpu %s, nice %d, ionice %d:%d\n",
+                job, getpid(), cpu_name, conf->nice, conf->ioprio_class, conf->ioprio_level);
+    }
+}
+
+static int
+places_own_branches(const struct ExpressionTree *tree)
+{
+    while (tree != NULL && tree->opcode == OP_LBR) {
+        tree = tree->left;
+    }
+    return tree != NULL && tree->opcode == OP_PARA;
+}
+
+static pid_t
+fork_job(struct ExpressionTree *tree, struct SuperStorage *storage, int in_fd, int out_fd)
+{
+    pid_t pid;
+    if ((pid = fork_child(tree)) < 0) {
+        raise_error(NULL, SYSCALL_ERROR);
+    } else if (pid == 0) {
+        if (in_fd >= 0) {
+            if (dup2(in_fd, 0) < 0) {
+                raise_error(NULL, SYSCALL_ERROR);
+            }
+            close(in_fd);
         }
-        waitpid(pid1, &status, 0);
-        if ((reverse == 0) == (WIFEXITED(status) && !WEXITSTATUS(status))) {
-            if ((pid2 = fork()) < 0) {
+        if (out_fd >= 0) {
+            if (dup2(out_fd, 1) < 0) {
                 raise_error(NULL, SYSCALL_ERROR);
-            } else if (pid2 == 0) {
-                execute(tree->right, storage);
             }
-        } else {
-            end_process(status);
+            close(out_fd);
         }
-        waitpid(pid2, &status, 0);
-        end_process(status);
-    case OP_SEMI:
-    case OP_ENDL:
-        if ((pid1 = fork()) < 0) {
-            raise_error(NULL, SYSCALL_ERROR);
-        } else if (pid1 == 0) {
-            execute(tree->left, storage);
+        // the nested "&" places its own branches and takes no job number of its own
+        if (tree != NULL && !places_own_branches(tree)) {
+            place_job();
+        }
+        execute_and_exit(tree, storage);
+    }
+    return pid;
+}
+
+static size_t
+group_memory(void)
+{
+    return (state.config->group_memory) ? state.config->group_memory : DEFAULT_GROUP_MEMORY;
+}
+
+static int
+new_chunk(void)
+{
+    int fd = memfd_create("jshell-chunk", MFD_CLOEXEC);
+    if (fd < 0) {
+        raise_error(NULL, SYSCALL_ERROR);
+    }
+    return fd;
+}
+
+static ssize_t
+fill_chunk(int in_fd, int chunk_fd, size_t size)
+{
+    ssize_t moved = splice(in_fd, NULL, chunk_fd, NULL, size, SPLICE_F_MOVE);
+    if (moved >= 0 || (errno != EINVAL && errno != ENOSYS)) {
+        return moved;
+    }
+    char buf[SPLICE_SIZE];
+    moved = read(in_fd, buf, (size < sizeof(buf)) ? size : sizeof(buf));
+    if (moved > 0 && write_all(chunk_fd, buf, moved) < 0) {
+        return -1;
+    }
+    return moved;
+}
+
+static off_t
+find_line_end(int fd, off_t from, off_t to)
+{
+    char buf[SPLICE_SIZE];
+    while (to > from) {
+        off_t start = (to - from > (off_t) sizeof(buf)) ? to - (off_t) sizeof(buf) : from;
+        ssize_t got = pread(fd, buf, to - start, start);
+        if (got <= 0) {
+            return -1;
         }
-        waitpid(pid1, &status, 0);
-        if (tree->right == NULL) {
-            end_process(status);
+        for (ssize_t i = got; i > 0; --i) {
+            if (buf[i - 1] == '\n') {
+                return start + i;
+            }
         }
-        if ((pid2 = fork()) < 0) {
+        to = start;
+    }
+    return -1;
+}
+
+static int
+execute_map(struct ExpressionTree *tree, struct SuperStorage *storage)
+{
+    long long workers = (tree->workers) ? tree->workers : state.config->map_workers;
+    if (workers <= 0 && (workers = sysconf(_SC_NPROCESSORS_ONLN)) <= 0) {
+        workers = 1;
+    }
+    off_t chunk_limit = (state.config->map_chunk) ? state.config->map_chunk : DEFAULT_MAP_CHUNK;
+
+    int fd[2];
+    pid_t producer;
+    if (pipe2(fd, O_CLOEXEC) < 0 || (producer = fork_child(tree->left)) < 0) {
+        raise_error(NULL, SYSCALL_ERROR);
+    } else if (producer == 0) {
+        if (dup2(fd[1], 1) < 0) {
             raise_error(NULL, SYSCALL_ERROR);
-        } else if (pid2 == 0) {
-            execute(tree->right, storage);
         }
-        waitpid(pid2, &status, 0);
-        end_process(status);
-    case OP_PIPE:
-        if (pipe(fd) < 0 || (pid1 = fork()) < 0) {
-            raise_error(NULL, SYSCALL_ERROR);
-        } else if (pid1 == 0) {
-            if (dup2(fd[1], 1) < 0) {
-                raise_error(NULL, SYSCALL_ERROR);
+        execute_and_exit(tree->left, storage);
+    }
+    close(fd[1]);
+    int upstream = fd[0];
+
+    size_t count = 0, cap = INIT_BRANCHES;
+    struct MapJob *jobs = malloc(cap * sizeof(*jobs));
+    // the timers of the producer and the running workers are polled as well
+    struct pollfd *fds = calloc(2 * workers + 2, sizeof(*fds));
+    size_t *polled = calloc(workers + 1, sizeof(*polled));
+    if (jobs == NULL || fds == NULL || polled == NULL) {
+        raise_error(NULL, MEMORY_ERROR);
+    }
+    int chunk = new_chunk(), eof = 0;
+    off_t chunk_size = 0, searched = 0;
+    size_t running = 0, first_running = 0, next_flush = 0;
+
+    while (!eof || running > 0) {
+        nfds_t polled_count = 0;
+        if (!eof && running < (size_t) workers) {
+            fds[polled_count].fd = upstream;
+            fds[polled_count].events = POLLIN;
+            polled[polled_count++] = count;
+        }
+        while (first_running < count && jobs[first_running].out.fd < 0) {
+            ++first_running;
+        }
+        for (size_t i = first_running; i < count; ++i) {
+            if (jobs[i].out.fd >= 0) {
+                fds[polled_count].fd = jobs[i].out.fd;
+                fds[polled_count].events = POLLIN;
+                polled[polled_count++] = i;
             }
-            close(fd[1]);
-            execute(tree->left, storage);
         }
-        close(fd[1]);
-        if ((pid2 = fork()) < 0) {
+        nfds_t timers_from = polled_count;
+        polled_count = poll_timers(fds, polled_count);
+        if (poll(fds, polled_count, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
             raise_error(NULL, SYSCALL_ERROR);
-        } else if (pid2 == 0) {
-            if (dup2(fd[0], 0) < 0) {
+        }
+        check_timers(fds, timers_from, polled_count);
+        for (nfds_t k = 0; k < timers_from; ++k) {
+            if (!fds[k].revents) {
+                continue;
+            }
+            if (polled[k] == count) {
+                // the input is gathered until a chunk is big enough and has a complete line
+                off_t want = (chunk_limit > chunk_size) ? chunk_limit - chunk_size : SPLICE_SIZE;
+                ssize_t moved = fill_chunk(upstream, chunk, want);
+                if (moved < 0) {
+                    if (errno == EINTR || errno == EAGAIN) {
+                        continue;
+                    }
+                    raise_error(NULL, SYSCALL_ERROR);
+                }
+                off_t cut = -1;
+                chunk_size += moved;
+                if (moved == 0) {
+                    eof = 1;
+                    cut = chunk_size;
+                } else if (chunk_size >= chunk_limit) {
+                    cut = find_line_end(chunk, searched, chunk_size);
+                    searched = chunk_size;
+                }
+                if (cut <= 0 && !(eof && count == 0)) {
+                    continue;
+                }
+
+                // the incomplete line after the cut is moved to the next chunk
+                int next = new_chunk();
+                char buf[SPLICE_SIZE];
+                for (off_t pos = cut; pos < chunk_size;) {
+                    ssize_t got = pread(chunk, buf, sizeof(buf), pos);
+                    if (got <= 0 || write_all(next, buf, got) < 0) {
+                        raise_error(NULL, SYSCALL_ERROR);
+                    }
+                    pos += got;
+                }
+                int out[2];
+                if (ftruncate(chunk, cut) < 0 || lseek(chunk, 0, SEEK_SET) < 0 || pipe2(out, O_CLOEXEC) < 0) {
+                    raise_error(NULL, SYSCALL_ERROR);
+                }
+                if (count == cap) {
+                    cap <<= 1;
+                    struct MapJob *tmp = realloc(jobs, cap * sizeof(*jobs));
+                    if (tmp == NULL) {
+                        raise_error(NULL, MEMORY_ERROR);
+                    }
+                    jobs = tmp;
+                }
+                jobs[count].pid = fork_job(tree->right, storage, chunk, out[1]);
+                jobs[count].status = 0;
+                collector_init(&jobs[count].out, out[0], group_memory());
+                close(out[1]);
+                close(chunk);
+                ++count;
+                ++running;
+                chunk = next;
+                chunk_size -= cut;
+                searched = chunk_size;
+            } else {
+                struct MapJob *job = &jobs[polled[k]];
+                int ret = collector_read(&job->out);
+                if (ret < 0) {
+                    raise_error(NULL, SYSCALL_ERROR);
+                } else if (ret == 0) {
+                    job->status = wait_process(job->pid);
+                    --running;
+                    if (tree->unordered && collector_flush(&job->out, 1) < 0) {
+                        raise_error(NULL, SYSCALL_ERROR);
+                    }
+                }
+            }
+        }
+        while (next_flush < count && jobs[next_flush].out.fd < 0) {
+            if (collector_flush(&jobs[next_flush].out, 1) < 0) {
                 raise_error(NULL, SYSCALL_ERROR);
             }
-            close(fd[0]);
-            execute(tree->right, storage);
+            collector_free(&jobs[next_flush++].out);
         }
-        close(fd[0]);
-        pid_t wait_ret;
-        while ((wait_ret = wait(&status)) != pid2 && wait_ret > 0) {}
-        while (wait(NULL) > 0) {}
-        end_process(status);
-    case OP_PARA:
-        if ((pid1 = fork()) < 0) {
-            raise_error(NULL, SYSCALL_ERROR);
-        } else if (pid1 == 0) {
-            execute(tree->left, storage);
+    }
+    close(chunk);
+    close(upstream);
+    wait_process(producer);
+
+    // the status is the one of the first worker that failed
+    int status = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (status == 0) {
+            status = jobs[i].status;
+        }
+    }
+    free(jobs);
+    free(fds);
+    free(polled);
+    return status;
+}
+
+static int
+execute_grouped(struct ExpressionTree *tree, struct SuperStorage *storage)
+{
+    /*
+     * "a & b & c" is parsed as ((a & b) & c), so the branches are
+     * the right operands along the left branch, taken from the bottom.
+     */
+    size_t count = 0, cap = INIT_BRANCHES;
+    struct ExpressionTree **branches = malloc(cap * sizeof(*branches));
+    if (branches == NULL) {
+        raise_error(NULL, MEMORY_ERROR);
+    }
+    while (1) {
+        if (count == cap) {
+            cap <<= 1;
+            struct ExpressionTree **tmp = realloc(branches, cap * sizeof(*branches));
+            if (tmp == NULL) {
+                raise_error(NULL, MEMORY_ERROR);
+            }
+            branches = tmp;
+        }
+        if (tree == NULL || tree->opcode != OP_PARA) {
+            branches[count++] = tree;
+            break;
+        }
+        branches[count++] = tree->right;
+        tree = tree->left;
+    }
+    for (size_t i = 0; i < count / 2; ++i) {
+        struct ExpressionTree *tmp = branches[i];
+        branches[i] = branches[count - i - 1];
+        branches[count - i - 1] = tmp;
+    }
+
+    struct OutputCollector *jobs = calloc(count, sizeof(*jobs));
+    struct pollfd *fds = calloc(2 * count, sizeof(*fds));
+    size_t *polled = calloc(count, sizeof(*polled));
+    pid_t *pids = calloc(count, sizeof(*pids));
+    if (jobs == NULL || fds == NULL || polled == NULL || pids == NULL) {
+        raise_error(NULL, MEMORY_ERROR);
+    }
+    size_t running = 0;
+    for (size_t i = 0; i < count; ++i) {
+        collector_init(&jobs[i], -1, group_memory());
+        if (branches[i] == NULL) {
+            continue;
         }
-        if ((pid2 = fork()) < 0) {
+        int fd[2];
+        if (pipe2(fd, O_CLOEXEC) < 0) {
             raise_error(NULL, SYSCALL_ERROR);
-        } else if (pid2 == 0) {
-            execute(tree->right, storage);
         }
-        while (wait(NULL) > 0) {}
-        exit(0);
-    case OP_LBR:
-        check_redirection(tree);
-        if (tree->right->opcode != OP_RBR) {
-            raise_error(storage->string, BRACKETS_BALANCE);
+        pids[i] = fork_job(branches[i], storage, -1, fd[1]);
+        close(fd[1]);
+        jobs[i].fd = fd[0];
+        ++running;
+    }
+
+    size_t next_flush = 0;
+    while (running > 0) {
+        nfds_t polled_count = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (jobs[i].fd >= 0) {
+                fds[polled_count].fd = jobs[i].fd;
+                fds[polled_count].events = POLLIN;
+                polled[polled_count++] = i;
+            }
         }
-        if ((pid1 = fork()) < 0) {
+        nfds_t timers_from = polled_count;
+        polled_count = poll_timers(fds, polled_count);
+        if (poll(fds, polled_count, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
             raise_error(NULL, SYSCALL_ERROR);
-        } else if (pid1 == 0) {
-            execute(tree->left, storage);
         }
-        waitpid(pid1, &status, 0);
-        end_process(status);
-    default:
-        raise_error(NULL, INTERNAL_ERROR);
+        check_timers(fds, timers_from, polled_count);
+        for (nfds_t k = 0; k < timers_from; ++k) {
+            if (!fds[k].revents) {
+                continue;
+            }
+            struct OutputCollector *job = &jobs[polled[k]];
+            int ret = collector_read(job);
+            if (ret < 0) {
+                raise_error(NULL, SYSCALL_ERROR);
+            } else if (ret == 0) {
+                --running;
+                if (!state.config->keep_order && collector_flush(job, 1) < 0) {
+                    raise_error(NULL, SYSCALL_ERROR);
+                }
+            }
+        }
+        while (state.config->keep_order && next_flush < count && jobs[next_flush].fd < 0) {
+            if (collector_flush(&jobs[next_flush++], 1) < 0) {
+                raise_error(NULL, SYSCALL_ERROR);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        if (branches[i] != NULL) {
+            wait_process(pids[i]);
+        }
+        collector_free(&jobs[i]);
+    }
+    free(branches);
+    free(jobs);
+    free(fds);
+    free(polled);
+    free(pids);
+    return 0;
+}
+
+int
+end_process(int status)
+{
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    } else {
+        return SIGNAL_ADD + WTERMSIG(status);
+    }
+}
+
+static int
+timeout_prefix(const struct ExpressionTree *tree, long long *at, long long *timeout)
+{
+    long long idx = 0;
+    while (idx < tree->cur_argc && assignment_name_len(tree->argv[idx]) > 0) {
+        ++idx;
+    }
+    while (idx < tree->cur_argc && is_annotation(tree->argv[idx])) {
+        ++idx;
     }
-}
\ No newline at end of file
+    // without a valid duration and a command it's the ordinary "timeout" command
+    if (idx + 2 >= tree->cur_argc || strcmp(tree->argv[idx], "timeout") != 0 ||
+        parse_duration(tree->argv[idx + 1], timeout) != 0) {
+        return 0;
+    }
+    *at = idx;
+    return 1;
+}
+
+static long long
+job_timeout(const struct ExpressionTree *tree)
+{
+    long long at, timeout;
+    if (tree != NULL && tree->opcode == OP_LBR) {
+        tree = tree->left;
+    }
+    if (tree != NULL && tree->opcode == OP_COM && timeout_prefix(tree, &at, &timeout)) {
+        return timeout;
+    }
+    return (getpid() == state.runner) ? state.config->job_timeout : 0;
+}
+
+static pid_t
+fork_child(const struct ExpressionTree *tree)
+{
+    const struct ExecutionConfig *conf = state.config;
+    long long timeout = job_timeout(tree);
+    int top = getpid() == state.runner;
+    struct JobLimits limits = {.memory = conf->job_memory, .cpu = conf->job_cpu, .pids = conf->job_pids};
+    int limited = top && job_limits_set(&limits);
+    struct JobCgroup group = {.dir_fd = -1};
+    pid_t pid = -1;
+    if (top && conf->cgroup_parent != NULL && (limited || conf->stats)) {
+        char name[sizeof("jshell--") + sizeof(pid_t) * 3 + sizeof(unsigned long) * 3];
+        snprintf(name, sizeof(name), "jshell-%d-%lu", state.runner, state.cgroup_count++);
+        if (cgroup_create(conf->cgroup_parent, name, &limits, &group) == 0 && (pid = cgroup_fork(&group)) < 0) {
+            // the leaf can't take the child, so the resource limits are used instead
+            cgroup_remove(&group);
+            group.applied = 0;
+        }
+    }
+    if (group.dir_fd < 0) {
+        pid = fork();
+    }
+    if (pid == 0) {
+        // the timers and the leaves belong to the parent
+        for (size_t i = 0; i < state.timer_count; ++i) {
+            close(state.timers[i].timer_fd);
+        }
+        state.timer_count = 0;
+        for (size_t i = 0; i < state.group_count; ++i) {
+            close(state.groups[i].cgroup.dir_fd);
+            free(state.groups[i].cgroup.path);
+        }
+        state.group_count = 0;
+        if (limited) {
+            apply_rlimits(&limits, group.applied);
+        }
+        if (timeout > 0) {
+            setpgid(0, 0);
+        }
+        return 0;
+    }
+    if (pid > 0 && group.dir_fd >= 0) {
+        if (state.group_count == state.group_capacity) {
+            size_t capacity = (state.group_capacity) ? state.group_capacity << 1 : INIT_BRANCHES;
+            struct JobGroup *tmp = realloc(state.groups, capacity * sizeof(*tmp));
+            if (tmp == NULL) {
+                raise_error(NULL, MEMORY_ERROR);
+            }
+            state.groups = tmp;
+            state.group_capacity = capacity;
+        }
+        state.groups[state.group_count].pid = pid;
+        state.groups[state.group_count++].cgroup = group;
+    }
+    if (pid > 0 && timeout > 0) {
+        arm_timer(pid, timeout);
+    }
+    return pid;
+}
+
+static void
+arm_timer(pid_t pid, long long timeout)
+{
+    // both sides set the group, so it exists whichever of them runs first
+    setpgid(pid, pid);
+    if (state.timer_count == state.timer_capacity) {
+        size_t capacity = (state.timer_capacity) ? state.timer_capacity << 1 : INIT_BRANCHES;
+        struct JobTimer *tmp = realloc(state.timers, capacity * sizeof(*tmp));
+        if (tmp == NULL) {
+            raise_error(NULL, MEMORY_ERROR);
+        }
+        state.timers = tmp;
+        state.timer_capacity = capacity;
+    }
+    struct JobTimer *timer = &state.timers[state.timer_count];
+    struct itimerspec when = {.it_value = {.tv_sec = timeout / 1000, .tv_nsec = timeout % 1000 * 1000000}};
+    timer->pid = pid;
+    timer->stage = 0;
+    timer->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (timer->timer_fd < 0 || timerfd_settime(timer->timer_fd, 0, &when, NULL) < 0) {
+        raise_error(NULL, SYSCALL_ERROR);
+    }
+    ++state.timer_count;
+}
+
+static void
+finish_job(pid_t pid, const struct rusage *usage)
+{
+    if (state.group_count == 0 && !state.config->stats) {
+        return;
+    }
+    // without a leaf the usage is the one of the child and the descendants it waited for
+    unsigned long long memory = (unsigned long long) usage->ru_maxrss << 10;
+    unsigned long long cpu_usec = (usage->ru_utime.tv_sec + usage->ru_stime.tv_sec) * 1000000ULL +
+                                  usage->ru_utime.tv_usec + usage->ru_stime.tv_usec;
+    for (size_t i = 0; i < state.group_count; ++i) {
+        if (state.groups[i].pid == pid) {
+            cgroup_usage(&state.groups[i].cgroup, &memory, &cpu_usec);
+            cgroup_remove(&state.groups[i].cgroup);
+            state.groups[i] = state.groups[--state.group_count];
+            break;
+        }
+    }
+    if (state.config->stats && getpid() == state.runner) {
+        fprintf(stderr, "jshell: pid %d: peak memory %llu KiB, cpu %llu ms\n", pid, memory >> 10, cpu_usec / 1000);
+    }
+}
+
+static void
+fire_timer(struct JobTimer *timer)
+{
+    unsigned long long expirations;
+    if (read(timer->timer_fd, &expirations, sizeof(expirations)) < 0 || timer->stage > 1) {
+        return;
+    }
+    if (timer->stage++ == 0) {
+        if (state.config->trace) {
+            fprintf(stderr, "jshell: pid %d: timed out\n", timer->pid);
+        }
+        kill(-timer->pid, SIGTERM);
+        struct itimerspec when = {.it_value = {.tv_sec = TIMEOUT_KILL_DELAY / 1000,
+                                               .tv_nsec = TIMEOUT_KILL_DELAY % 1000 * 1000000}};
+        timerfd_settime(timer->timer_fd, 0, &when, NULL);
+    } else {
+        kill(-timer->pid, SIGKILL);
+    }
+}
+
+static nfds_t
+poll_timers(struct pollfd *fds, nfds_t count)
+{
+    for (size_t i = 0; i < state.timer_count; ++i) {
+        fds[count].fd = state.timers[i].timer_fd;
+        fds[count++].events = POLLIN;
+    }
+    return count;
+}
+
+static void
+check_timers(const struct pollfd *fds, nfds_t from, nfds_t to)
+{
+    for (nfds_t k = from; k < to; ++k) {
+        for (size_t i = 0; fds[k].revents && i < state.timer_count; ++i) {
+            if (state.timers[i].timer_fd == fds[k].fd) {
+                fire_timer(&state.timers[i]);
+            }
+        }
+    }
+}
+
+static int
+wait_readable(int fd, int timeout)
+{
+    struct pollfd *fds = malloc((state.timer_count + 1) * sizeof(*fds));
+    if (fds == NULL) {
+        raise_error(NULL, MEMORY_ERROR);
+    }
+    int ret;
+    do {
+        fds[0].fd = fd;
+        fds[0].events = POLLIN;
+        nfds_t count = poll_timers(fds, 1);
+        if ((ret = poll(fds, count, timeout)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            raise_error(NULL, SYSCALL_ERROR);
+        }
+        check_timers(fds, 1, count);
+    } while (ret != 0 && !fds[0].revents);
+    ret = fds[0].revents != 0;
+    free(fds);
+    return ret;
+}
+
+static int
+wait_process(pid_t pid)
+{
+    int status;
+    struct rusage usage;
+    if (state.timer_count == 0) {
+        while (wait4(pid, &status, 0, &usage) < 0) {
+            if (errno != EINTR) {
+                raise_error(NULL, INTERNAL_ERROR);
+            }
+        }
+        finish_job(pid, &usage);
+        return end_process(status);
+    }
+
+    // the running children may time out while this one is waited for
+#ifdef SYS_pidfd_open
+    int pid_fd = syscall(SYS_pidfd_open, pid, 0);
+#else
+    int pid_fd = -1;
+#endif
+    pid_t ret;
+    if (pid_fd >= 0) {
+        wait_readable(pid_fd, -1);
+        close(pid_fd);
+    }
+    while ((ret = wait4(pid, &status, (pid_fd < 0) ? WNOHANG : 0, &usage)) != pid) {
+        if (ret < 0 && errno != EINTR) {
+            raise_error(NULL, INTERNAL_ERROR);
+        } else if (ret == 0) {
+            wait_readable(-1, TIMEOUT_POLL_INTERVAL);
+        }
+    }
+    finish_job(pid, &usage);
+    size_t idx = 0;
+    while (idx < state.timer_count && state.timers[idx].pid != pid) {
+        ++idx;
+    }
+    if (idx == state.timer_count) {
+        return end_process(status);
+    }
+    struct JobTimer timer = state.timers[idx];
+    state.timers[idx] = state.timers[--state.timer_count];
+    close(timer.timer_fd);
+    return (timer.stage > 0) ? TIMEOUT_EXIT : end_process(status);
+}
+
+static struct ExpressionTree **
+collect_statements(struct ExpressionTree *tree, size_t *count)
+{
+    size_t cap = INIT_SEQUENCE;
+    struct ExpressionTree **statements = malloc(cap * sizeof(*statements));
+    if (statements == NULL) {
+        raise_error(NULL, MEMORY_ERROR);
+    }
+    // the right operands are gathered from the top and reversed, the bottom operand comes first
+    *count = 0;
+    while (1) {
+        int last = tree == NULL || (tree->opcode != OP_SEMI && tree->opcode != OP_ENDL);
+        struct ExpressionTree *statement = (last) ? tree : tree->right;
+        if (*count == cap) {
+            cap <<= 1;
+            struct ExpressionTree **tmp = realloc(statements, cap * sizeof(*statements));
+            if (tmp == NULL) {
+                free(statements);
+                raise_error(NULL, MEMORY_ERROR);
+            }
+            statements = tmp;
+        }
+        if (statement != NULL) {
+            statements[(*count)++] = statement;
+        }
+        if (last) {
+            break;
+        }
+        tree = tree->left;
+    }
+    for (size_t i = 0; i < *count / 2; ++i) {
+        struct ExpressionTree *tmp = statements[i];
+        statements[i] = statements[*count - i - 1];
+        statements[*count - i - 1] = tmp;
+    }
+    return statements;
+}
+
+static int
+execute_sequence(struct ExpressionTree *tree, struct SuperStorage *storage)
+{
+    size_t count;
+    struct ExpressionTree **statements = collect_statements(tree, &count);
+    int status = 0, parallel = state.config->parallel && getpid() == state.runner;
+    size_t from = 0;
+    for (size_t i = 0; i <= count; ++i) {
+        // with --parallel the statements between the ones setting variables and "wait" are run at once
+        if (i < count && parallel && !changes_shell(statements[i]) &&
+            !(statements[i]->opcode == OP_COM && statements[i]->cur_argc == 1 &&
+              strcmp(statements[i]->argv[0], "wait") == 0)) {
+            continue;
+        }
+        if (from < i) {
+            status = execute_parallel(statements + from, i - from, storage);
+        }
+        if (i < count) {
+            status = execute(statements[i], storage);
+        }
+        from = i + 1;
+    }
+    free(statements);
+    return status;
+}
+
+static int
+is_annotation(const char *word)
+{
+    return word[0] == '@' && (word[1] == 'r' || word[1] == 'w') && word[2] == ':' && word[3] != '\0';
+}
+
+static char *
+file_key(const char *path)
+{
+    const char *slash = strrchr(path, '/'), *base = (slash != NULL) ? slash + 1 : path;
+    char *dir = (slash == NULL) ? strdup(".") : (slash == path) ? strdup("/") : strndup(path, slash - path);
+    char *key = NULL;
+    struct stat st;
+    if (dir == NULL) {
+        raise_error(NULL, MEMORY_ERROR);
+    }
+    int ret;
+    if (*base && strcmp(base, ".") != 0 && strcmp(base, "..") != 0 && stat(dir, &st) == 0) {
+        ret = asprintf(&key, "%llx:%llx/%s", (unsigned long long) st.st_dev, (unsigned long long) st.st_ino, base);
+    } else if (stat(path, &st) == 0) {
+        ret = asprintf(&key, "%llx:%llx", (unsigned long long) st.st_dev, (unsigned long long) st.st_ino);
+    } else {
+        // the directory doesn't exist yet, so the path itself is the best name there is
+        ret = ((key = strdup(path)) != NULL) ? 0 : -1;
+    }
+    free(dir);
+    if (ret < 0) {
+        raise_error(NULL, MEMORY_ERROR);
+    }
+    return key;
+}
+
+static void
+add_accesses(struct DependencyGraph *graph, size_t index, const struct ExpressionTree *tree)
+{
+    for (; tree != NULL; tree = tree->left) {
+        const struct redirector *redirects[] = {&tree->redirect.in, &tree->redirect.out, &tree->redirect.append};
+        const char *files[sizeof(redirects) / sizeof(redirects[0])] = {};
+        int writes[sizeof(redirects) / sizeof(redirects[0])] = {0, 1, 1};
+        for (size_t i = 0; tree->redirect.need_redirect && i < sizeof(redirects) / sizeof(redirects[0]); ++i) {
+            if (redirects[i]->exists) {
+                files[i] = redirects[i]->file;
+            }
+        }
+        long long word = 0;
+        while (tree->opcode == OP_COM && word < tree->cur_argc && assignment_name_len(tree->argv[word]) > 0) {
+            ++word;
+        }
+        for (size_t i = 0;; ++i) {
+            const char *file;
+            int write;
+            if (i < sizeof(files) / sizeof(files[0])) {
+                file = files[i];
+                write = writes[i];
+            } else if (tree->opcode == OP_COM && word < tree->cur_argc && is_annotation(tree->argv[word])) {
+                file = tree->argv[word] + 3;
+                write = tree->argv[word++][1] == 'w';
+            } else {
+                break;
+            }
+            if (file == NULL) {
+                continue;
+            }
+            char *path = redirection_file(file), *key = file_key(path);
+            if (graph_access(graph, index, key, write) < 0) {
+                raise_error(NULL, MEMORY_ERROR);
+            }
+            free(path);
+            free(key);
+        }
+        for (long long i = 0; i < tree->subst_count; ++i) {
+            add_accesses(graph, index, tree->substs[i]);
+        }
+        add_accesses(graph, index, tree->right);
+    }
+}
+
+static int
+execute_parallel(struct ExpressionTree **statements, size_t count, struct SuperStorage *storage)
+{
+    if (count == 1) {
+        return execute(statements[0], storage);
+    }
+    long long workers = state.config->parallel_workers;
+    if (workers <= 0 && (workers = sysconf(_SC_NPROCESSORS_ONLN)) <= 0) {
+        workers = 1;
+    }
+    struct DependencyGraph graph;
+    if (graph_init(&graph, count) < 0) {
+        raise_error(NULL, MEMORY_ERROR);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        add_accesses(&graph, i, statements[i]);
+    }
+
+    struct OutputCollector *jobs = calloc(count, sizeof(*jobs));
+    pid_t *pids = calloc(count, sizeof(*pids));
+    int *statuses = calloc(count, sizeof(*statuses));
+    size_t *ready = calloc(count, sizeof(*ready));
+    // each running statement may have a timer
+    struct pollfd *fds = calloc(2 * workers, sizeof(*fds));
+    size_t *polled = calloc(workers, sizeof(*polled));
+    if (jobs == NULL || pids == NULL || statuses == NULL || ready == NULL || fds == NULL || polled == NULL) {
+        raise_error(NULL, MEMORY_ERROR);
+    }
+    size_t ready_from = 0, ready_to = 0, running = 0, next_flush = 0;
+    for (size_t i = 0; i < count; ++i) {
+        collector_init(&jobs[i], -1, group_memory());
+        if (graph.pending[i] == 0) {
+            ready[ready_to++] = i;
+        }
+    }
+
+    while (next_flush < count) {
+        while (running < (size_t) workers && ready_from < ready_to) {
+            size_t idx = ready[ready_from++];
+            int fd[2];
+            forget_created_files(statements[idx]);
+            if (pipe2(fd, O_CLOEXEC) < 0 || (pids[idx] = fork_child(statements[idx])) < 0) {
+                raise_error(NULL, SYSCALL_ERROR);
+            } else if (pids[idx] == 0) {
+                if (dup2(fd[1], 1) < 0) {
+                    raise_error(NULL, SYSCALL_ERROR);
+                }
+                execute_and_exit(statements[idx], storage);
+            }
+            close(fd[1]);
+            jobs[idx].fd = fd[0];
+            ++running;
+            if (state.config->trace) {
+                fprintf(stderr, "jshell: statement %zu: pid %d, %zu running\n", idx, pids[idx], running);
+            }
+        }
+        nfds_t polled_count = 0;
+        for (size_t i = next_flush; i < count; ++i) {
+            if (jobs[i].fd >= 0) {
+                fds[polled_count].fd = jobs[i].fd;
+                fds[polled_count].events = POLLIN;
+                polled[polled_count++] = i;
+            }
+        }
+        nfds_t timers_from = polled_count;
+        polled_count = poll_timers(fds, polled_count);
+        if (timers_from > 0 && poll(fds, polled_count, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            raise_error(NULL, SYSCALL_ERROR);
+        }
+        check_timers(fds, timers_from, polled_count);
+        for (nfds_t k = 0; k < timers_from; ++k) {
+            if (!fds[k].revents) {
+                continue;
+            }
+            size_t idx = polled[k];
+            int ret = collector_read(&jobs[idx]);
+            if (ret < 0) {
+                raise_error(NULL, SYSCALL_ERROR);
+            } else if (ret == 0) {
+                // the statements waiting only for this one can start now
+                statuses[idx] = wait_process(pids[idx]);
+                --running;
+                for (size_t i = 0; i < graph.next_count[idx]; ++i) {
+                    if (--graph.pending[graph.next[idx][i]] == 0) {
+                        ready[ready_to++] = graph.next[idx][i];
+                    }
+                }
+            }
+        }
+        while (next_flush < count && pids[next_flush] != 0 && jobs[next_flush].fd < 0) {
+            if (collector_flush(&jobs[next_flush], 1) < 0) {
+                raise_error(NULL, SYSCALL_ERROR);
+            }
+            collector_free(&jobs[next_flush++]);
+        }
+    }
+
+    int status = statuses[count - 1];
+    graph_free(&graph);
+    free(jobs);
+    free(pids);
+    free(statuses);
+    free(ready);
+    free(fds);
+    free(polled);
+    return status;
+}
+
+static int
+assignments_only(const struct ExpressionTree *tree)
+{
+    long long idx = 0;
+    while (idx < tree->cur_argc && assignment_name_len(tree->argv[idx]) > 0) {
+        ++idx;
+    }
+    while (idx < tree->cur_argc && is_annotation(tree->argv[idx])) {
+        ++idx;
+    }
+    return idx == tree->cur_argc;
+}
+
+static int
+changes_shell(const struct ExpressionTree *tree)
+{
+    if (tree == NULL || tree->redirect.need_redirect) {
+        return 0;
+    }
+    switch (tree->opcode) {
+    case OP_COM: {
+        long long idx = 0;
+        while (idx < tree->cur_argc && is_annotation(tree->argv[idx])) {
+            ++idx;
+        }
+        return assignments_only(tree) || (idx < tree->cur_argc && strcmp(tree->argv[idx], "export") == 0);
+    }
+    case OP_CONJ:
+    case OP_DISJ:
+    case OP_SEMI:
+    case OP_ENDL:
+        return changes_shell(tree->left) || changes_shell(tree->right);
+    case OP_WHILE:
+    case OP_FOR:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static void
+collect_files(const struct ExpressionTree *tree, struct WordList *files)
+{
+    for (; tree != NULL; tree = tree->left) {
+        const struct redirector *redirects[] = {&tree->redirect.out, &tree->redirect.in, &tree->redirect.append};
+        for (size_t i = 0; tree->redirect.need_redirect && i < sizeof(redirects) / sizeof(redirects[0]); ++i) {
+            if (redirects[i]->exists && redirects[i]->file != NULL &&
+                add_word(files, redirection_file(redirects[i]->file)) < 0) {
+                raise_error(NULL, MEMORY_ERROR);
+            }
+        }
+        for (long long i = 0; i < tree->subst_count; ++i) {
+            collect_files(tree->substs[i], files);
+        }
+        collect_files(tree->right, files);
+    }
+}
+
+static int
+execute_journaled(struct ExpressionTree *tree, struct SuperStorage *storage)
+{
+    size_t count;
+    struct ExpressionTree **statements = collect_statements(tree, &count);
+    int status = 0, resuming = state.config->resume;
+    for (size_t i = 0; i < count; ++i) {
+        unsigned long long hash = statement_hash(statements[i]);
+        // the variables are set again, so that the statements after them see the same values
+        int setter = changes_shell(statements[i]);
+        if (resuming && !setter && journal_valid(&state.journal, i, hash)) {
+            if (state.config->trace) {
+                fprintf(stderr, "jshell: statement %zu: done before\n", i);
+            }
+            status = 0;
+            continue;
+        }
+        resuming = resuming && setter;
+        status = execute(statements[i], storage);
+        struct WordList files = {};
+        collect_files(statements[i], &files);
+        if (journal_write(&state.journal, i, hash, status, files.words, files.count) < 0) {
+            perror(state.config->journal);
+        }
+        free_words(&files);
+    }
+    free(statements);
+    return status;
+}
+
+static int
+execute_loop(struct ExpressionTree *tree, struct SuperStorage *storage)
+{
+    int status = 0;
+    if (tree->opcode == OP_WHILE) {
+        while (execute(tree->left, storage) == 0) {
+            status = execute(tree->right, storage);
+        }
+    } else {
+        struct WordList words = {};
+        struct ExpandContext context;
+        start_expansion(tree, storage, &context);
+        for (long long i = 1; i < tree->cur_argc; ++i) {
+            if (expand_word(tree->argv[i], &context, &words) < 0) {
+                raise_error(NULL, MEMORY_ERROR);
+            }
+        }
+        end_expansion(&context);
+        for (size_t i = 0; i < words.count; ++i) {
+            if (variable_set(&state.variables, tree->argv[0], strlen(tree->argv[0]), words.words[i], 0) < 0) {
+                raise_error(NULL, MEMORY_ERROR);
+            }
+            status = execute(tree->right, storage);
+        }
+        free_words(&words);
+    }
+    return status;
+}
+
+static void
+forget_created_files(const struct ExpressionTree *tree)
+{
+    // the long left branch of a sequence is walked without recursion
+    for (; tree != NULL && state.globs.count > 0; tree = tree->left) {
+        const struct redirector *files[] = {&tree->redirect.out, &tree->redirect.append};
+        for (size_t i = 0; tree->redirect.need_redirect && i < sizeof(files) / sizeof(files[0]); ++i) {
+            if (files[i]->exists && files[i]->file != NULL) {
+                char *file = redirection_file(files[i]->file);
+                glob_forget(&state.globs, file);
+                free(file);
+            }
+        }
+        for (long long i = 0; i < tree->subst_count; ++i) {
+            forget_created_files(tree->substs[i]);
+        }
+        forget_created_files(tree->right);
+    }
+}
+
+static int
+start_expansion(struct ExpressionTree *tree, struct SuperStorage *storage, struct ExpandContext *context)
+{
+    int status = 0;
+    context->variables = &state.variables;
+    context->globs = &state.globs;
+    context->outputs = NULL;
+    context->output_count = context->next_output = 0;
+    if (tree->subst_count > 0 && (context->outputs = calloc(tree->subst_count, sizeof(char *))) == NULL) {
+        raise_error(NULL, MEMORY_ERROR);
+    }
+    for (long long i = 0; i < tree->subst_count; ++i) {
+        context->outputs[context->output_count++] = capture_output(tree->substs[i], storage, &status);
+    }
+    return status;
+}
+
+static void
+end_expansion(struct ExpandContext *context)
+{
+    for (size_t i = 0; i < context->output_count; ++i) {
+        free(context->outputs[i]);
+    }
+    free(context->outputs);
+}
+
+static char *
+capture_output(struct ExpressionTree *tree, struct SuperStorage *storage, int *status)
+{
+    struct WordList words = {};
+    size_t assigns = 0;
+    const struct Builtin *builtin = NULL;
+    int simple = tree != NULL && tree->opcode == OP_COM && !tree->redirect.need_redirect;
+    char *data = NULL;
+    size_t size = 0;
+    if (simple) {
+        *status = expand_command(tree, storage, &words, &assigns);
+        builtin = (words.count > assigns) ? find_builtin(words.words[assigns]) : NULL;
+    }
+    if (simple && words.count == assigns) {
+        // the assignments of "$(...)" are forgotten with its output
+        free_words(&words);
+        data = strdup("");
+        if (data == NULL) {
+            raise_error(NULL, MEMORY_ERROR);
+        }
+        return data;
+    }
+
+    if (builtin != NULL && builtin->pure) {
+        FILE *out = open_memstream(&data, &size);
+        if (out == NULL) {
+            raise_error(NULL, SYSCALL_ERROR);
+        }
+        *status = builtin->func(words.words + assigns, &state.variables, out);
+        if (fclose(out) != 0) {
+            raise_error(NULL, SYSCALL_ERROR);
+        }
+    } else {
+        int fd[2];
+        pid_t pid;
+        forget_created_files(tree);
+        if (pipe2(fd, O_CLOEXEC) < 0 || (pid = fork_child(tree)) < 0) {
+            raise_error(NULL, SYSCALL_ERROR);
+        } else if (pid == 0) {
+            if (dup2(fd[1], 1) < 0) {
+                raise_error(NULL, SYSCALL_ERROR);
+            }
+            // the words are already expanded, their substitutions must not run twice
+            if (simple) {
+                run_command(tree, &words, assigns);
+            }
+            execute_and_exit(tree, storage);
+        }
+        close(fd[1]);
+        struct OutputCollector out;
+        collector_init(&out, fd[0], SIZE_MAX);
+        int ret;
+        do {
+            wait_readable(out.fd, -1);
+        } while ((ret = collector_read(&out)) > 0);
+        if (ret < 0 || (data = realloc(out.data, out.size + 1)) == NULL) {
+            raise_error(NULL, SYSCALL_ERROR);
+        }
+        size = out.size;
+        *status = wait_process(pid);
+    }
+    free_words(&words);
+    while (size > 0 && data[size - 1] == '\n') {
+        --size;
+    }
+    data[size] = '\0';
+    return data;
+}
+
+static int
+expand_command(struct ExpressionTree *tree, struct SuperStorage *storage, struct WordList *words, size_t *assigns)
+{
+    // an assignment is recognised before the expansion, so "$A=b" is a command
+    struct ExpandContext context;
+    int status = start_expansion(tree, storage, &context);
+    *assigns = 0;
+    while ((long long) *assigns < tree->cur_argc && assignment_name_len(tree->argv[*assigns]) > 0) {
+        ++*assigns;
+    }
+    // the timer of "timeout DURATION" is armed by the parent, here the prefix is just dropped
+    long long at = -1, timeout;
+    if (!timeout_prefix(tree, &at, &timeout)) {
+        at = -1;
+    }
+    long long annotated = *assigns;
+    while (annotated < tree->cur_argc && is_annotation(tree->argv[annotated])) {
+        ++annotated;
+    }
+    for (long long i = 0; i < tree->cur_argc; ++i) {
+        if ((at >= 0 && (i == at || i == at + 1)) || ((size_t) i >= *assigns && i < annotated)) {
+            continue;
+        }
+        // the value of an assignment is neither split nor globbed
+        int ret = ((size_t) i < *assigns) ? add_word(words, expand_string(tree->argv[i], &context)) :
+                  expand_word(tree->argv[i], &context, words);
+        if (ret < 0) {
+            raise_error(NULL, MEMORY_ERROR);
+        }
+    }
+    end_expansion(&context);
+    return status;
+}
+
+static int
+execute_command(struct ExpressionTree *tree, struct SuperStorage *storage)
+{
+    if (assignments_only(tree) && !tree->redirect.need_redirect) {
+        // every value is expanded after the assignments before it, so "A=1 B=$A" sets B to 1
+        struct ExpandContext context;
+        int status = start_expansion(tree, storage, &context);
+        for (long long i = 0; i < tree->cur_argc; ++i) {
+            size_t len = assignment_name_len(tree->argv[i]);
+            if (len == 0) {
+                continue;
+            }
+            char *word = expand_string(tree->argv[i], &context);
+            if (word == NULL || variable_set(&state.variables, word, len, word + len + 1, 0) < 0) {
+                raise_error(NULL, MEMORY_ERROR);
+            }
+            free(word);
+        }
+        end_expansion(&context);
+        return status;
+    }
+    struct WordList words = {};
+    size_t assigns;
+    int status = expand_command(tree, storage, &words, &assigns);
+    // the words after the assignments may expand to nothing
+    if (words.count == assigns && !tree->redirect.need_redirect) {
+        for (size_t i = 0; i < assigns; ++i) {
+            size_t len = assignment_name_len(words.words[i]);
+            if (variable_set(&state.variables, words.words[i], len, words.words[i] + len + 1, 0) < 0) {
+                raise_error(NULL, MEMORY_ERROR);
+            }
+        }
+        free_words(&words);
+        return status;
+    }
+    // a builtin with assignments or redirections runs in a child like any other command
+    const struct Builtin *builtin = NULL;
+    if (assigns == 0 && !tree->redirect.need_redirect) {
+        builtin = find_builtin(words.words[0]);
+    }
+    if (builtin != NULL) {
+        status = builtin->func(words.words, &state.variables, stdout);
+        fflush(stdout);
+        free_words(&words);
+        return status;
+    }
+    forget_created_files(tree);
+    pid_t pid;
+    if ((pid = fork_child(tree)) < 0) {
+        raise_error(NULL, SYSCALL_ERROR);
+    } else if (pid == 0) {
+        run_command(tree, &words, assigns);
+    }
+    free_words(&words);
+    return wait_process(pid);
+}
+
+static _Noreturn void
+run_command(struct ExpressionTree *tree, struct WordList *words, size_t assigns)
+{
+    for (size_t i = 0; i < assigns; ++i) {
+        size_t len = assignment_name_len(words->words[i]);
+        if (variable_set(&state.variables, words->words[i], len, words->words[i] + len + 1, 1) < 0) {
+            raise_error(NULL, MEMORY_ERROR);
+        }
+    }
+    check_redirection(tree);
+    if (words->count == assigns) {
+        leave(0);
+    }
+    char **argv = words->words + assigns;
+    const struct Builtin *builtin = find_builtin(argv[0]);
+    if (builtin != NULL) {
+        leave(builtin->func(argv, &state.variables, stdout));
+    }
+    // the table's envp is the environment, so PATH is looked up in it as well
+    environ = state.variables.envp;
+    close_descriptors();
+    execvp(argv[0], argv);
+    perror(argv[0]);
+    leave(EXEC_ERROR);
+}
+
+static _Noreturn void
+execute_and_exit(struct ExpressionTree *tree, struct SuperStorage *storage)
+{
+    if (tree != NULL && tree->opcode == OP_COM) {
+        struct WordList words = {};
+        size_t assigns;
+        expand_command(tree, storage, &words, &assigns);
+        run_command(tree, &words, assigns);
+    }
+    leave(execute(tree, storage));
+}
+
+static int
+execute(struct ExpressionTree *tree, struct SuperStorage *storage)
+{
+    if (tree == NULL) {
+        return 0;
+    }
+    int reverse = 0, status, fd[2];
+    pid_t pid1, pid2;
+    switch (tree->opcode) {
+    case OP_COM:
+        return execute_command(tree, storage);
+    case OP_EOF:
+        return 0;
+    case OP_DISJ:
+        reverse = 1;
+    case OP_CONJ:
+        status = execute(tree->left, storage);
+        if ((reverse == 0) == (status == 0)) {
+            return execute(tree->right, storage);
+        }
+        return status;
+    case OP_SEMI:
+    case OP_ENDL:
+        return execute_sequence(tree, storage);
+    case OP_PIPE:
+        forget_created_files(tree);
+        if (pipe2(fd, O_CLOEXEC) < 0 || (pid1 = fork_child(tree->left)) < 0) {
+            raise_error(NULL, SYSCALL_ERROR);
+        } else if (pid1 == 0) {
+            if (dup2(fd[1], 1) < 0) {
+                raise_error(NULL, SYSCALL_ERROR);
+            }
+            close(fd[1]);
+            execute_and_exit(tree->left, storage);
+        }
+        close(fd[1]);
+        if ((pid2 = fork_child(tree->right)) < 0) {
+            raise_error(NULL, SYSCALL_ERROR);
+        } else if (pid2 == 0) {
+            if (dup2(fd[0], 0) < 0) {
+                raise_error(NULL, SYSCALL_ERROR);
+            }
+            close(fd[0]);
+            execute_and_exit(tree->right, storage);
+        }
+        close(fd[0]);
+        status = wait_process(pid2);
+        wait_process(pid1);
+        return status;
+    case OP_MAP:
+        forget_created_files(tree);
+        return execute_map(tree, storage);
+    case OP_WHILE:
+    case OP_FOR:
+        if (!tree->redirect.need_redirect) {
+            return execute_loop(tree, storage);
+        }
+        // the redirected loop runs in a child, so that the shell's own descriptors stay as they are
+        forget_created_files(tree);
+        if ((pid1 = fork_child(tree)) < 0) {
+            raise_error(NULL, SYSCALL_ERROR);
+        } else if (pid1 == 0) {
+            check_redirection(tree);
+            leave(execute_loop(tree, storage));
+        }
+        return wait_process(pid1);
+    case OP_PARA:
+        forget_created_files(tree);
+        if (state.config->group) {
+            return execute_grouped(tree, storage);
+        }
+        pid1 = fork_job(tree->left, storage, -1, -1);
+        pid2 = fork_job(tree->right, storage, -1, -1);
+        wait_process(pid1);
+        wait_process(pid2);
+        return 0;
+    case OP_LBR:
+        forget_created_files(tree);
+        if ((pid1 = fork_child(tree)) < 0) {
+            raise_error(NULL, SYSCALL_ERROR);
+        } else if (pid1 == 0) {
+            check_redirection(tree);
+            if (tree->right->opcode != OP_RBR) {
+                raise_error(storage->string, BRACKETS_BALANCE);
+            }
+            execute_and_exit(tree->left, storage);
+        }
+        return wait_process(pid1);
+    default:
+        raise_error(NULL, INTERNAL_ERROR);
+    }
+}
@@ -1,9 +1,69 @@
 #ifndef SHELL_EXECUTOR_H
 #define SHELL_EXECUTOR_H
 
+#include <stddef.h>
+
 struct SuperStorage;
 
+struct ExecutionConfig
+{
+    int trace;
+    int *cpus;
+    int cpu_count;
+    int nice;
+    int ioprio_class;
+    int ioprio_level;
+    int group;
+    int keep_order;
+    size_t group_memory;
+    long long map_workers;
+    size_t map_chunk;
+    long long job_timeout;
+    const char *cgroup_parent;
+    size_t job_memory;
+    double job_cpu;
+    long long job_pids;
+    int stats;
+    const char *journal;
+    int resume;
+    int parallel;
+    long long parallel_workers;
+};
+/*
+ * trace: print what the executor decides for the jobs to stderr
+ * cpus: the CPUs the branches of "&" are pinned to in turn, NULL if not pinned
+ * nice: the niceness added to the branches of "&"
+ * ioprio_class, ioprio_level: the I/O scheduling of the branches of "&", class 0 keeps it
+ * group: the output of every branch of "&" is written out as a whole when the branch completes
+ * keep_order: the grouped outputs are written in the order of the branches
+ * group_memory: the bytes of each grouped output kept in memory, the rest is spilled to a file,
+ *     0 means the default 1M
+ * map_workers: the workers of "|%" without a number, 0 means one per CPU
+ * map_chunk: the size of the pieces "|%" splits its input into, 0 means the default one
+ * job_timeout: the milliseconds every child started by the shell itself may run before it is
+ *     terminated, 0 means no limit
+ * cgroup_parent: the cgroup v2 directory every child started by the shell itself gets its own leaf in,
+ *     NULL to use the resource limits of the process instead
+ * job_memory, job_cpu, job_pids: the limits of such a child: bytes, CPUs and processes, 0 means no limit
+ * stats: print the peak memory and the CPU time of every such child to stderr
+ * journal: the file the top-level statements are recorded in, NULL if they are not
+ * resume: skip the statements the journal says are done, up to the first one that failed or changed
+ * parallel: run the statements of a ";" list that use different files at once,
+ *     not together with journal, which runs the top-level statements one by one
+ * parallel_workers: the statements run at once by parallel, 0 means one per CPU
+ */
+
+int
+start_execution(struct SuperStorage *storage, const struct ExecutionConfig *config);
+// runs the parsed tree in a child process and returns its exit code
+
+int
+run_tree(struct SuperStorage *storage, const struct ExecutionConfig *config);
+// runs the parsed tree in the current process and returns its exit code,
+// the config may be NULL to run with the defaults
+
 int
-start_execution(struct SuperStorage *storage);
+end_process(int status);
+// converts the status filled by waitpid into the shell's exit code
 
 #endif
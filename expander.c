@@ -0,0 +1,214 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include "expander.h"
+#include "glob.h"
+#include "syntax.h"
+#include "variables.h"
+
+enum
+{
+    INIT_WORDS = 8,
+    INIT_STRING = 64
+};
+
+struct String
+{
+    char *data;
+    size_t size;
+    size_t capacity;
+};
+
+static int
+append(struct String *str, const char *data, size_t size);
+// appends the bytes to the string keeping it null-terminated, returns 0 or -1
+
+static int
+split_output(const char *output, struct String *str, int *literal, struct WordList *fields);
+// appends the output to the current field, starting a new field at every run of spaces
+
+static int
+substitute(const char *word, struct ExpandContext *context, struct String *str, int *literal,
+           struct WordList *fields);
+// writes the expanded word to the string, literal is set if the current field has any
+// symbols besides the expansions; the outputs are split into the fields unless it's NULL
+
+static int
+append(struct String *str, const char *data, size_t size)
+{
+    if (str->size + size + 1 > str->capacity) {
+        size_t capacity = (str->capacity) ? str->capacity : INIT_STRING;
+        while (str->size + size + 1 > capacity) {
+            capacity <<= 1;
+        }
+        char *tmp = realloc(str->data, capacity);
+        if (tmp == NULL) {
+            return -1;
+        }
+        str->data = tmp;
+        str->capacity = capacity;
+    }
+    memcpy(str->data + str->size, data, size);
+    str->size += size;
+    str->data[str->size] = '\0';
+    return 0;
+}
+
+static int
+split_output(const char *output, struct String *str, int *literal, struct WordList *fields)
+{
+    while (*output) {
+        size_t len = 0;
+        while (output[len] && !isspace((unsigned char) output[len])) {
+            ++len;
+        }
+        if (append(str, output, len) < 0) {
+            return -1;
+        }
+        output += len;
+        if (!*output) {
+            break;
+        }
+        while (isspace((unsigned char) *output)) {
+            ++output;
+        }
+        if (str->size > 0 || *literal) {
+            if (add_word(fields, str->data) < 0) {
+                str->data = NULL;
+                return -1;
+            }
+            memset(str, 0, sizeof(*str));
+            *literal = 0;
+            if (append(str, "", 0) < 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int
+substitute(const char *word, struct ExpandContext *context, struct String *str, int *literal,
+           struct WordList *fields)
+{
+    *literal = 0;
+    if (append(str, "", 0) < 0) {
+        return -1;
+    }
+    while (*word) {
+        size_t plain = strcspn(word, (const char[]){'$', SUBST_MARK, '\0'});
+        if (plain > 0) {
+            *literal = 1;
+            if (append(str, word, plain) < 0) {
+                return -1;
+            }
+            word += plain;
+            continue;
+        }
+        if (*word == SUBST_MARK && context->next_output < context->output_count) {
+            const char *output = context->outputs[context->next_output++];
+            ++word;
+            if (fields == NULL) {
+                if (append(str, output, strlen(output)) < 0) {
+                    return -1;
+                }
+            } else if (split_output(output, str, literal, fields) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        // "$" that doesn't start a name is taken as it is
+        int braced = word[0] == '$' && word[1] == '{';
+        const char *name = word + 1 + braced;
+        size_t len = (*word == '$') ? variable_name_len(name) : 0;
+        if (len == 0 || (braced && name[len] != '}')) {
+            *literal = 1;
+            if (append(str, word, 1) < 0) {
+                return -1;
+            }
+            ++word;
+            continue;
+        }
+        const char *value = variable_get(context->variables, name, len);
+        if (value != NULL && append(str, value, strlen(value)) < 0) {
+            return -1;
+        }
+        word = name + len + braced;
+    }
+    return 0;
+}
+
+char *
+expand_string(const char *word, struct ExpandContext *context)
+{
+    struct String str = {};
+    int literal;
+    if (substitute(word, context, &str, &literal, NULL) < 0) {
+        free(str.data);
+        return NULL;
+    }
+    return str.data;
+}
+
+int
+add_word(struct WordList *list, char *word)
+{
+    if (word == NULL) {
+        return -1;
+    }
+    if (list->count + 2 > list->capacity) {
+        size_t capacity = (list->capacity) ? list->capacity << 1 : INIT_WORDS;
+        char **tmp = realloc(list->words, capacity * sizeof(*tmp));
+        if (tmp == NULL) {
+            free(word);
+            return -1;
+        }
+        list->words = tmp;
+        list->capacity = capacity;
+    }
+    list->words[list->count++] = word;
+    list->words[list->count] = NULL;
+    return 0;
+}
+
+int
+expand_word(const char *word, struct ExpandContext *context, struct WordList *list)
+{
+    struct WordList fields = {};
+    struct String str = {};
+    int literal;
+    int ret = substitute(word, context, &str, &literal, &fields);
+    if (ret == 0 && (str.size > 0 || literal)) {
+        ret = add_word(&fields, str.data);
+        str.data = NULL;
+    }
+    free(str.data);
+    for (size_t i = 0; ret == 0 && i < fields.count; ++i) {
+        char *field = fields.words[i];
+        fields.words[i] = NULL;
+        if (context->globs != NULL && has_glob(field)) {
+            ret = glob_word(field, context->globs, list);
+        } else {
+            ret = add_word(list, field);
+        }
+    }
+    free_words(&fields);
+    return ret;
+}
+
+size_t
+assignment_name_len(const char *word)
+{
+    size_t len = variable_name_len(word);
+    return (len > 0 && word[len] == '=') ? len : 0;
+}
+
+void
+free_words(struct WordList *list)
+{
+    for (size_t i = 0; i < list->count; ++i) {
+        free(list->words[i]);
+    }
+    free(list->words);
+    memset(list, 0, sizeof(*list));
+}
@@ -0,0 +1,56 @@
+#ifndef SHELL_EXPANDER_H
+#define SHELL_EXPANDER_H
+
+#include <stddef.h>
+
+struct VariableTable;
+struct GlobCache;
+
+struct WordList
+{
+    char **words;
+    size_t count;
+    size_t capacity;
+};
+// a growing NULL-terminated list of the words a command is run with
+
+struct ExpandContext
+{
+    const struct VariableTable *variables;
+    struct GlobCache *globs;
+    char **outputs;
+    size_t output_count;
+    size_t next_output;
+};
+/*
+ * What the words of one command are expanded with.
+ * globs: the patterns are replaced by the matching paths, NULL to keep them
+ * outputs: the outputs of the command's "$(...)" in order, each one
+ *     replaces the next SUBST_MARK of the words
+ */
+
+char *
+expand_string(const char *word, struct ExpandContext *context);
+// substitutes the variables and the outputs in the word without splitting it,
+// an unset variable gives "", returns the new string or NULL if the memory is out
+
+int
+expand_word(const char *word, struct ExpandContext *context, struct WordList *list);
+// appends the fields of the expanded word to the list: an output of "$(...)" is split
+// by spaces, a word made of expansions only is dropped if it is empty and the patterns
+// are globbed, returns 0 or -1 if the memory is out
+
+int
+add_word(struct WordList *list, char *word);
+// appends the word to the list, which takes it, returns 0 or -1 if the memory is out
+// (a NULL word is the result of an allocation that failed)
+
+size_t
+assignment_name_len(const char *word);
+// returns the length of NAME if the word is "NAME=value", 0 otherwise
+
+void
+free_words(struct WordList *list);
+// frees up the list and its words
+
+#endif
@@ -0,0 +1,379 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "glob.h"
+#include "expander.h"
+
+enum
+{
+    DENTS_BATCH = 1 << 18,
+    INIT_ENTRIES = 256,
+    INIT_NAMES = 1 << 12,
+    INIT_DIRS = 8
+};
+
+struct LinuxDirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+// the record filled by getdents64
+
+static int
+match_pattern(const char *pattern, size_t pattern_len, const char *name);
+// checks if the name matches the pattern of one path component
+
+static int
+compare_entries(const void *first, const void *second);
+
+static int
+compare_words(const void *first, const void *second);
+
+static int
+read_listing(const char *path, struct DirListing *dir);
+// reads the directory with getdents64, returns 0 or -1 if it can't be read
+
+static long long
+get_listing(struct GlobCache *cache, const char *path);
+// returns the index of the cached listing of the directory, reading it on the first use, -1 on error
+
+static int
+glob_from(struct GlobCache *cache, const char *path, const char *rest, struct WordList *list);
+// matches the rest of the pattern against the files under the path, which is "" or ends with "/",
+// returns 0 or -1 if the memory is out
+
+static char *
+join_path(const char *path, const char *name, size_t name_len, int slash);
+// returns path + name, followed by "/" if slash isn't 0
+
+int
+has_glob(const char *word)
+{
+    return strpbrk(word, "*?[") != NULL;
+}
+
+static int
+match_pattern(const char *pattern, size_t pattern_len, const char *name)
+{
+    const char *end = pattern + pattern_len, *star = NULL, *star_name = NULL;
+    while (*name) {
+        if (pattern < end && *pattern == '*') {
+            star = ++pattern;
+            star_name = name;
+            continue;
+        }
+        int matched = 0;
+        if (pattern < end && *pattern == '?') {
+            matched = 1;
+            ++pattern;
+        } else if (pattern < end && *pattern == '[') {
+            const char *pos = pattern + 1;
+            int negate = (pos < end && (*pos == '!' || *pos == '^'));
+            pos += negate;
+            int found = 0;
+            const char *first = pos;
+            while (pos < end && (*pos != ']' || pos == first)) {
+                if (pos + 2 < end && pos[1] == '-' && pos[2] != ']') {
+                    found |= (unsigned char) *name >= (unsigned char) pos[0] &&
+                             (unsigned char) *name <= (unsigned char) pos[2];
+                    pos += 3;
+                } else {
+                    found |= *name == *pos++;
+                }
+            }
+            if (pos < end) {
+                matched = found != negate;
+                pattern = pos + 1;
+            } else {
+                // "[" without "]" is an ordinary symbol
+                matched = *name == '[';
+                ++pattern;
+            }
+        } else if (pattern < end) {
+            matched = *pattern++ == *name;
+        }
+        if (matched) {
+            ++name;
+        } else if (star != NULL) {
+            pattern = star;
+            name = ++star_name;
+        } else {
+            return 0;
+        }
+    }
+    while (pattern < end && *pattern == '*') {
+        ++pattern;
+    }
+    return pattern == end;
+}
+
+static int
+compare_entries(const void *first, const void *second)
+{
+    return strcmp(((const struct DirEntry *) first)->name, ((const struct DirEntry *) second)->name);
+}
+
+static int
+compare_words(const void *first, const void *second)
+{
+    return strcmp(*(char *const *) first, *(char *const *) second);
+}
+
+static int
+read_listing(const char *path, struct DirListing *dir)
+{
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+    dir->dev = st.st_dev;
+    dir->ino = st.st_ino;
+    char *batch = malloc(DENTS_BATCH);
+    size_t cap = INIT_ENTRIES, names_cap = INIT_NAMES, names_size = 0;
+    size_t *offsets = malloc(cap * sizeof(*offsets));
+    unsigned char *types = malloc(cap);
+    char *names = malloc(names_cap);
+    size_t count = 0;
+    long got = 0;
+    while (batch != NULL && offsets != NULL && types != NULL && names != NULL &&
+           (got = syscall(SYS_getdents64, fd, batch, DENTS_BATCH)) > 0) {
+        for (long pos = 0; pos < got;) {
+            const struct LinuxDirent64 *dirent = (const struct LinuxDirent64 *) (batch + pos);
+            pos += dirent->d_reclen;
+            if (strcmp(dirent->d_name, ".") == 0 || strcmp(dirent->d_name, "..") == 0) {
+                continue;
+            }
+            size_t len = strlen(dirent->d_name) + 1;
+            if (count == cap) {
+                cap <<= 1;
+                size_t *tmp_offsets = realloc(offsets, cap * sizeof(*offsets));
+                offsets = (tmp_offsets != NULL) ? tmp_offsets : offsets;
+                unsigned char *tmp_types = realloc(types, cap);
+                types = (tmp_types != NULL) ? tmp_types : types;
+                if (tmp_offsets == NULL || tmp_types == NULL) {
+                    got = -1;
+                    break;
+                }
+            }
+            if (names_size + len > names_cap) {
+                while (names_size + len > names_cap) {
+                    names_cap <<= 1;
+                }
+                char *tmp = realloc(names, names_cap);
+                if (tmp == NULL) {
+                    got = -1;
+                    break;
+                }
+                names = tmp;
+            }
+            memcpy(names + names_size, dirent->d_name, len);
+            offsets[count] = names_size;
+            types[count++] = dirent->d_type;
+            names_size += len;
+        }
+        if (got < 0) {
+            break;
+        }
+    }
+    close(fd);
+    struct DirEntry *entries = NULL;
+    if (got == 0 && batch != NULL && offsets != NULL && types != NULL && names != NULL) {
+        entries = malloc((count + 1) * sizeof(*entries));
+    }
+    if (entries != NULL) {
+        for (size_t i = 0; i < count; ++i) {
+            entries[i].name = names + offsets[i];
+            entries[i].type = types[i];
+        }
+        qsort(entries, count, sizeof(*entries), compare_entries);
+        dir->entries = entries;
+        dir->count = count;
+        dir->names = names;
+    } else {
+        free(names);
+    }
+    free(batch);
+    free(offsets);
+    free(types);
+    return (entries != NULL) ? 0 : -1;
+}
+
+static long long
+get_listing(struct GlobCache *cache, const char *path)
+{
+    for (size_t i = 0; i < cache->count; ++i) {
+        if (strcmp(cache->dirs[i].path, path) == 0) {
+            return i;
+        }
+    }
+    if (cache->count == cache->capacity) {
+        size_t capacity = (cache->capacity) ? cache->capacity << 1 : INIT_DIRS;
+        struct DirListing *tmp = realloc(cache->dirs, capacity * sizeof(*tmp));
+        if (tmp == NULL) {
+            return -1;
+        }
+        cache->dirs = tmp;
+        cache->capacity = capacity;
+    }
+    struct DirListing *dir = &cache->dirs[cache->count];
+    if ((dir->path = strdup(path)) == NULL) {
+        return -1;
+    }
+    if (read_listing(path, dir) < 0) {
+        free(dir->path);
+        return -1;
+    }
+    return cache->count++;
+}
+
+static char *
+join_path(const char *path, const char *name, size_t name_len, int slash)
+{
+    size_t path_len = strlen(path);
+    char *res = malloc(path_len + name_len + 2);
+    if (res != NULL) {
+        memcpy(res, path, path_len);
+        memcpy(res + path_len, name, name_len);
+        res[path_len + name_len] = '/';
+        res[path_len + name_len + (slash != 0)] = '\0';
+    }
+    return res;
+}
+
+static int
+glob_from(struct GlobCache *cache, const char *path, const char *rest, struct WordList *list)
+{
+    const char *slash = strchr(rest, '/');
+    size_t len = (slash != NULL) ? (size_t) (slash - rest) : strlen(rest);
+    char *component = strndup(rest, len);
+    if (component == NULL) {
+        return -1;
+    }
+    int meta = has_glob(component);
+    free(component);
+
+    if (!meta) {
+        char *next = join_path(path, rest, len, slash != NULL);
+        if (next == NULL) {
+            return -1;
+        }
+        if (slash != NULL) {
+            int ret = glob_from(cache, next, slash + 1, list);
+            free(next);
+            return ret;
+        }
+        struct stat st;
+        if (lstat(next, &st) < 0) {
+            free(next);
+            return 0;
+        }
+        return add_word(list, next);
+    }
+
+    // the listing is kept under the name the redirections are checked against
+    size_t path_len = strlen(path);
+    char *dir_name = (path_len == 0) ? strdup(".") :
+                     (path_len == 1) ? strdup(path) : strndup(path, path_len - 1);
+    if (dir_name == NULL) {
+        return -1;
+    }
+    long long dir = get_listing(cache, dir_name);
+    free(dir_name);
+    if (dir < 0) {
+        return 0;
+    }
+    // the listings may move while the subdirectories are read, so the index is kept
+    for (size_t i = 0; i < cache->dirs[dir].count; ++i) {
+        const struct DirEntry *entry = &cache->dirs[dir].entries[i];
+        // a leading dot is matched only by a dot in the pattern
+        if ((entry->name[0] == '.' && rest[0] != '.') || !match_pattern(rest, len, entry->name)) {
+            continue;
+        }
+        if (slash != NULL && entry->type != DT_DIR && entry->type != DT_LNK && entry->type != DT_UNKNOWN) {
+            continue;
+        }
+        char *next = join_path(path, entry->name, strlen(entry->name), slash != NULL);
+        if (next == NULL) {
+            return -1;
+        }
+        if (slash == NULL) {
+            if (add_word(list, next) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        int ret = glob_from(cache, next, slash + 1, list);
+        free(next);
+        if (ret < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int
+glob_word(char *word, struct GlobCache *cache, struct WordList *list)
+{
+    size_t first = list->count;
+    int ret = (word[0] == '/') ? glob_from(cache, "/", word + 1, list) : glob_from(cache, "", word, list);
+    if (ret < 0) {
+        free(word);
+        return -1;
+    }
+    if (list->count == first) {
+        return add_word(list, word);
+    }
+    free(word);
+    qsort(list->words + first, list->count - first, sizeof(*list->words), compare_words);
+    return 0;
+}
+
+void
+glob_forget(struct GlobCache *cache, const char *file)
+{
+    const char *slash = strrchr(file, '/');
+    size_t len = (slash == NULL) ? 1 : (slash == file) ? 1 : (size_t) (slash - file);
+    char *dir_name = strndup((slash == NULL) ? "." : file, len);
+    struct stat st;
+    // a directory that can't be found by the path is compared by the path as it's written
+    int found = dir_name != NULL && stat(dir_name, &st) == 0;
+    for (size_t i = 0; i < cache->count;) {
+        struct DirListing *dir = &cache->dirs[i];
+        if ((found) ? dir->dev == st.st_dev && dir->ino == st.st_ino :
+                      dir_name == NULL || strcmp(dir->path, dir_name) == 0) {
+            free(dir->path);
+            free(dir->entries);
+            free(dir->names);
+            *dir = cache->dirs[--cache->count];
+        } else {
+            ++i;
+        }
+    }
+    free(dir_name);
+}
+
+void
+glob_cache_free(struct GlobCache *cache)
+{
+    for (size_t i = 0; i < cache->count; ++i) {
+        free(cache->dirs[i].path);
+        free(cache->dirs[i].entries);
+        free(cache->dirs[i].names);
+    }
+    free(cache->dirs);
+    memset(cache, 0, sizeof(*cache));
+}
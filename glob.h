@@ -0,0 +1,55 @@
+#ifndef SHELL_GLOB_H
+#define SHELL_GLOB_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+struct WordList;
+
+struct DirEntry
+{
+    const char *name;
+    unsigned char type;
+};
+// type is d_type of the entry, DT_UNKNOWN if the file system doesn't tell it
+
+struct DirListing
+{
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    struct DirEntry *entries;
+    size_t count;
+    char *names;
+};
+// the entries of one directory sorted by name, names holds all of them,
+// dev and ino tell the directory whatever path it was read by
+
+struct GlobCache
+{
+    struct DirListing *dirs;
+    size_t count;
+    size_t capacity;
+};
+// the directories read during the run, each one is read once until it's forgotten
+
+int
+has_glob(const char *word);
+// checks if the word has any of "*", "?" and "["
+
+int
+glob_word(char *word, struct GlobCache *cache, struct WordList *list);
+// appends the sorted paths matching the pattern to the list, or the word itself if none match,
+// the word is taken by the function, returns 0 or -1 if the memory is out
+
+void
+glob_forget(struct GlobCache *cache, const char *file);
+// drops the listings of the directory the file is in, found by its device and inode,
+// so "./x", "d/../x" and an absolute path forget the same listing,
+// called when the file may have been created
+
+void
+glob_cache_free(struct GlobCache *cache);
+// frees up all the listings
+
+#endif
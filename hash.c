@@ -0,0 +1,21 @@
+#include "hash.h"
+
+static const unsigned long long FNV_OFFSET = 14695981039346656037ULL;
+static const unsigned long long FNV_PRIME = 1099511628211ULL;
+
+unsigned long long
+hash_bytes(const void *data, size_t size)
+{
+    return hash_continue(FNV_OFFSET, data, size);
+}
+
+unsigned long long
+hash_continue(unsigned long long hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
@@ -0,0 +1,14 @@
+#ifndef SHELL_HASH_H
+#define SHELL_HASH_H
+
+#include <stddef.h>
+
+unsigned long long
+hash_bytes(const void *data, size_t size);
+// returns the FNV-1a hash of the bytes
+
+unsigned long long
+hash_continue(unsigned long long hash, const void *data, size_t size);
+// adds more bytes to the hash returned for the bytes before them
+
+#endif
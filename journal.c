@@ -0,0 +1,289 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "journal.h"
+#include "hash.h"
+#include "collector.h"
+#include "syntax.h"
+
+enum
+{
+    JOURNAL_BATCH = 64,
+    JOURNAL_SYNC_INTERVAL = 200,
+    READ_SIZE = 1 << 16
+};
+// the records are synced after JOURNAL_BATCH of them or JOURNAL_SYNC_INTERVAL milliseconds,
+// whichever comes first
+
+static unsigned long long
+hash_tree(const struct ExpressionTree *tree, unsigned long long hash);
+
+static void
+free_record(struct JournalRecord *record);
+
+static int
+read_records(struct Journal *journal);
+// reads the records of the file and cuts off a record left incomplete by a crash
+
+static const char *
+parse_record(const char *pos, const char *end, size_t *index, struct JournalRecord *record);
+// parses one record, returns the position after it or NULL if it's incomplete
+
+static unsigned long long
+hash_tree(const struct ExpressionTree *tree, unsigned long long hash)
+{
+    if (tree == NULL) {
+        return hash_continue(hash, "", 1);
+    }
+    int opcode = tree->opcode;
+    hash = hash_continue(hash, &opcode, sizeof(opcode));
+    for (long long i = 0; i < tree->cur_argc; ++i) {
+        hash = hash_continue(hash, tree->argv[i], strlen(tree->argv[i]) + 1);
+    }
+    const struct redirector *files[] = {&tree->redirect.out, &tree->redirect.in, &tree->redirect.append};
+    for (size_t i = 0; tree->redirect.need_redirect && i < sizeof(files) / sizeof(files[0]); ++i) {
+        if (files[i]->exists && files[i]->file != NULL) {
+            hash = hash_continue(hash, &i, sizeof(i));
+            hash = hash_continue(hash, files[i]->file, strlen(files[i]->file) + 1);
+        }
+    }
+    hash = hash_continue(hash, &tree->workers, sizeof(tree->workers));
+    hash = hash_continue(hash, &tree->unordered, sizeof(tree->unordered));
+    for (long long i = 0; i < tree->subst_count; ++i) {
+        hash = hash_tree(tree->substs[i], hash);
+    }
+    return hash_tree(tree->right, hash_tree(tree->left, hash));
+}
+
+unsigned long long
+statement_hash(const struct ExpressionTree *tree)
+{
+    return hash_tree(tree, hash_bytes(NULL, 0));
+}
+
+static void
+free_record(struct JournalRecord *record)
+{
+    for (size_t i = 0; i < record->file_count; ++i) {
+        free(record->files[i].path);
+    }
+    free(record->files);
+    memset(record, 0, sizeof(*record));
+}
+
+static const char *
+parse_record(const char *pos, const char *end, size_t *index, struct JournalRecord *record)
+{
+    char *next;
+    memset(record, 0, sizeof(*record));
+    *index = strtoull(pos, &next, 10);
+    if (next == pos || *next != ' ') {
+        return NULL;
+    }
+    record->hash = strtoull(next + 1, &next, 16);
+    if (*next != ' ') {
+        return NULL;
+    }
+    record->status = strtol(next + 1, &next, 10);
+    if (*next != ' ') {
+        return NULL;
+    }
+    size_t count = strtoull(next + 1, &next, 10);
+    if (count > (size_t) (end - next) || (record->files = calloc(count + 1, sizeof(*record->files))) == NULL) {
+        return NULL;
+    }
+    for (; record->file_count < count; ++record->file_count) {
+        // a file is written as " SEC.NSEC LEN:PATH", or " - LEN:PATH" if it didn't exist
+        struct JournalFile *file = &record->files[record->file_count];
+        if (*next != ' ') {
+            break;
+        }
+        if (next[1] == '-') {
+            next += 2;
+        } else {
+            file->exists = 1;
+            file->mtime.tv_sec = strtoll(next + 1, &next, 10);
+            if (*next != '.') {
+                break;
+            }
+            file->mtime.tv_nsec = strtol(next + 1, &next, 10);
+        }
+        if (*next != ' ') {
+            break;
+        }
+        size_t len = strtoull(next + 1, &next, 10);
+        if (*next != ':' || len > (size_t) (end - next - 1) || (file->path = strndup(next + 1, len)) == NULL) {
+            break;
+        }
+        next += len + 1;
+    }
+    if (record->file_count < count || *next != '\n') {
+        free_record(record);
+        return NULL;
+    }
+    record->present = 1;
+    return next + 1;
+}
+
+static int
+read_records(struct Journal *journal)
+{
+    size_t size = 0, capacity = READ_SIZE;
+    char *data = malloc(capacity + 1);
+    if (data == NULL) {
+        return -1;
+    }
+    ssize_t got;
+    while ((got = pread(journal->fd, data + size, capacity - size, size)) != 0) {
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            free(data);
+            return -1;
+        }
+        size += got;
+        if (size == capacity) {
+            char *tmp = realloc(data, (capacity <<= 1) + 1);
+            if (tmp == NULL) {
+                free(data);
+                return -1;
+            }
+            data = tmp;
+        }
+    }
+    data[size] = '\0';
+
+    const char *pos = data, *end = data + size;
+    while (pos < end) {
+        size_t index;
+        struct JournalRecord record;
+        const char *next = parse_record(pos, end, &index, &record);
+        if (next == NULL) {
+            break;
+        }
+        if (index >= journal->record_count) {
+            size_t count = index + 1;
+            struct JournalRecord *tmp = realloc(journal->records, count * sizeof(*tmp));
+            if (tmp == NULL) {
+                free_record(&record);
+                free(data);
+                return -1;
+            }
+            memset(tmp + journal->record_count, 0, (count - journal->record_count) * sizeof(*tmp));
+            journal->records = tmp;
+            journal->record_count = count;
+        }
+        free_record(&journal->records[index]);
+        journal->records[index] = record;
+        pos = next;
+    }
+    // the next records must not be appended to a broken one
+    int ret = (pos < end) ? ftruncate(journal->fd, pos - data) : 0;
+    free(data);
+    return ret;
+}
+
+int
+journal_open(struct Journal *journal, const char *path, int resume)
+{
+    memset(journal, 0, sizeof(*journal));
+    clock_gettime(CLOCK_MONOTONIC, &journal->synced);
+    int flags = O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC | ((resume) ? 0 : O_TRUNC);
+    if ((journal->fd = open(path, flags, 0666)) < 0) {
+        return -1;
+    }
+    if (resume && read_records(journal) < 0) {
+        journal_close(journal);
+        return -1;
+    }
+    return 0;
+}
+
+int
+journal_valid(const struct Journal *journal, size_t index, unsigned long long hash)
+{
+    if (index >= journal->record_count) {
+        return 0;
+    }
+    const struct JournalRecord *record = &journal->records[index];
+    if (!record->present || record->hash != hash || record->status != 0) {
+        return 0;
+    }
+    for (size_t i = 0; i < record->file_count; ++i) {
+        const struct JournalFile *file = &record->files[i];
+        struct stat st;
+        int exists = stat(file->path, &st) == 0;
+        if (exists != file->exists || (exists && (st.st_mtim.tv_sec != file->mtime.tv_sec ||
+                                                  st.st_mtim.tv_nsec != file->mtime.tv_nsec))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int
+journal_write(struct Journal *journal, size_t index, unsigned long long hash, int status,
+              char *const *paths, size_t count)
+{
+    char *data = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&data, &size);
+    if (out == NULL) {
+        return -1;
+    }
+    fprintf(out, "%zu %016llx %d %zu", index, hash, status, count);
+    for (size_t i = 0; i < count; ++i) {
+        struct stat st;
+        if (stat(paths[i], &st) == 0) {
+            fprintf(out, " %lld.%09ld", (long long) st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+        } else {
+            fprintf(out, " -");
+        }
+        fprintf(out, " %zu:%s", strlen(paths[i]), paths[i]);
+    }
+    fputc('\n', out);
+    if (fclose(out) != 0) {
+        free(data);
+        return -1;
+    }
+    // the record is written at once, so a crash can only cut off the last one
+    int ret = write_all(journal->fd, data, size);
+    free(data);
+    if (ret < 0) {
+        return -1;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long elapsed = (now.tv_sec - journal->synced.tv_sec) * 1000LL +
+                        (now.tv_nsec - journal->synced.tv_nsec) / 1000000;
+    if (++journal->unsynced >= JOURNAL_BATCH || elapsed >= JOURNAL_SYNC_INTERVAL) {
+        journal->unsynced = 0;
+        journal->synced = now;
+        return fdatasync(journal->fd);
+    }
+    return 0;
+}
+
+int
+journal_close(struct Journal *journal)
+{
+    int ret = 0;
+    if (journal->fd >= 0) {
+        ret = (journal->unsynced > 0) ? fdatasync(journal->fd) : 0;
+        close(journal->fd);
+    }
+    for (size_t i = 0; i < journal->record_count; ++i) {
+        free_record(&journal->records[i]);
+    }
+    free(journal->records);
+    memset(journal, 0, sizeof(*journal));
+    journal->fd = -1;
+    return ret;
+}
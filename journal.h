@@ -0,0 +1,71 @@
+#ifndef SHELL_JOURNAL_H
+#define SHELL_JOURNAL_H
+
+#include <stddef.h>
+#include <time.h>
+
+struct ExpressionTree;
+
+struct JournalFile
+{
+    char *path;
+    struct timespec mtime;
+    int exists;
+};
+// a redirection file of a statement and its modification time when the statement was over
+
+struct JournalRecord
+{
+    int present;
+    unsigned long long hash;
+    int status;
+    struct JournalFile *files;
+    size_t file_count;
+};
+/*
+ * What the previous runs know about one top-level statement.
+ * present: 0 if the statement has no record
+ * hash: the hash of the statement's words, operators and redirections
+ * status: the exit code of the statement
+ */
+
+struct Journal
+{
+    int fd;
+    struct JournalRecord *records;
+    size_t record_count;
+    size_t unsynced;
+    struct timespec synced;
+};
+/*
+ * The journal of the top-level statements of a script.
+ * fd: the journal file, records are only appended to it and the last record of a statement wins
+ * records: the records read when the run is resumed, indexed by the statement
+ * unsynced, synced: the records written since the last fdatasync and its time
+ */
+
+int
+journal_open(struct Journal *journal, const char *path, int resume);
+// opens the journal file, on resume its records are read, otherwise it's truncated,
+// returns 0 or -1 on error
+
+unsigned long long
+statement_hash(const struct ExpressionTree *tree);
+// hashes the parsed statement, the variables and the substitutions are not expanded
+
+int
+journal_valid(const struct Journal *journal, size_t index, unsigned long long hash);
+// checks that the statement succeeded in a previous run, has not changed since then
+// and its redirection files have not been modified
+
+int
+journal_write(struct Journal *journal, size_t index, unsigned long long hash, int status,
+              char *const *paths, size_t count);
+// appends the record of the finished statement with the modification times of the paths,
+// the file is synced once for a batch of records, returns 0 or -1 on error
+
+int
+journal_close(struct Journal *journal);
+// syncs the records written and closes the journal, returns 0 or -1 on error
+
+#endif
@@ -0,0 +1,162 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdio_ext.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "jshell.h"
+#include "executor.h"
+#include "syntax.h"
+
+enum
+{
+    STD_FDS = 3
+};
+
+struct JShellScript
+{
+    struct SuperStorage storage;
+};
+
+struct JShellJob
+{
+    pid_t pid;
+    jshell_callback callback;
+    void *data;
+};
+
+static void *
+wait_job(void *arg);
+// waits for the run to finish and passes its exit code to the callback
+
+static _Noreturn void
+run_child(const struct JShellScript *script, const int fds[STD_FDS], const struct ExecutionConfig *config);
+// sets up the standard descriptors and runs the script in the forked child
+
+int
+jshell_parse(const char *text, struct JShellScript **script, struct JShellError *error)
+{
+    *script = NULL;
+    struct JShellScript *res = calloc(1, sizeof(*res));
+    char *str = strdup(text);
+    if (res == NULL || str == NULL) {
+        free(res);
+        free(str);
+        if (error != NULL) {
+            error->code = MEMORY_ERROR;
+            error->offset = 0;
+        }
+        return MEMORY_ERROR;
+    }
+    int code = syntax_parse(&res->storage, str);
+    if (code) {
+        if (error != NULL) {
+            error->code = code;
+            error->offset = (res->storage.container.place != NULL) ? res->storage.container.place - str : 0;
+        }
+        jshell_free(res);
+        return code;
+    }
+    *script = res;
+    return 0;
+}
+
+void
+jshell_free(struct JShellScript *script)
+{
+    if (script != NULL) {
+        delete_expression_tree(script->storage.parsing_tree, &script->storage);
+        free(script->storage.string);
+        free(script);
+    }
+}
+
+static _Noreturn void
+run_child(const struct JShellScript *script, const int fds[STD_FDS], const struct ExecutionConfig *config)
+{
+    // the output buffered by the caller must not be written out by the child
+    __fpurge(stdout);
+    if (fds != NULL) {
+        /*
+         * The descriptors are first moved above the standard ones,
+         * so that the caller may pass them in any order.
+         */
+        int moved[STD_FDS];
+        for (int i = 0; i < STD_FDS; ++i) {
+            moved[i] = (fds[i] >= 0) ? fcntl(fds[i], F_DUPFD, STD_FDS) : -1;
+            if (fds[i] >= 0 && moved[i] < 0) {
+                _exit(SYSCALL_ERROR);
+            }
+        }
+        for (int i = 0; i < STD_FDS; ++i) {
+            if (moved[i] >= 0) {
+                if (dup2(moved[i], i) < 0) {
+                    _exit(SYSCALL_ERROR);
+                }
+                close(moved[i]);
+            }
+        }
+    }
+    struct SuperStorage storage = script->storage;
+    int code = run_tree(&storage, config);
+    fflush(stdout);
+    _exit(code);
+}
+
+static void *
+wait_job(void *arg)
+{
+    struct JShellJob *job = arg;
+    int status, code = -1;
+    pid_t ret;
+    while ((ret = waitpid(job->pid, &status, 0)) < 0 && errno == EINTR) {}
+    if (ret == job->pid) {
+        code = end_process(status);
+    }
+    if (job->callback != NULL) {
+        job->callback(code, job->data);
+    }
+    free(job);
+    return NULL;
+}
+
+int
+jshell_run(const struct JShellScript *script, const int fds[3], jshell_callback callback, void *data)
+{
+    return jshell_run_config(script, fds, NULL, callback, data);
+}
+
+int
+jshell_run_config(const struct JShellScript *script, const int fds[3], const struct ExecutionConfig *config,
+                  jshell_callback callback, void *data)
+{
+    struct JShellJob *job = calloc(1, sizeof(*job));
+    if (job == NULL) {
+        return MEMORY_ERROR;
+    }
+    job->callback = callback;
+    job->data = data;
+    if ((job->pid = fork()) < 0) {
+        free(job);
+        return SYSCALL_ERROR;
+    } else if (job->pid == 0) {
+        run_child(script, fds, config);
+    }
+
+    pthread_attr_t attr;
+    pthread_t waiter;
+    if (pthread_attr_init(&attr) != 0) {
+        wait_job(job);
+        return 0;
+    }
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&waiter, &attr, wait_job, job) != 0) {
+        // no thread to wait in, so the run is waited for synchronously
+        wait_job(job);
+    }
+    pthread_attr_destroy(&attr);
+    return 0;
+}
@@ -0,0 +1,51 @@
+#ifndef SHELL_JSHELL_H
+#define SHELL_JSHELL_H
+
+/*
+ * Reentrant interface of the shell for embedding into a long-lived process.
+ * Nothing here terminates the caller or keeps global state, so scripts can
+ * be parsed and run from several threads at once. The processes of a run leave
+ * through _exit and close the caller's descriptors before exec, so the caller's
+ * atexit handlers, streams and files stay its own.
+ */
+
+#include "error_handler.h"
+
+struct JShellScript;
+// the parsed command line, an opaque handle
+
+struct ExecutionConfig;
+
+struct JShellError
+{
+    enum ErrorCode code;
+    unsigned long long offset;
+};
+// the reason the parsing failed and the offset of the failure in the text
+
+typedef void (*jshell_callback)(int status, void *data);
+// receives the exit code of a finished run (or -1 if it could not be waited for)
+
+int
+jshell_parse(const char *text, struct JShellScript **script, struct JShellError *error);
+// parses the text into a new handle, returns 0 on success,
+// otherwise returns the error code and fills the error if it's not NULL
+
+int
+jshell_run(const struct JShellScript *script, const int fds[3], jshell_callback callback, void *data);
+// starts the script in a separate process with fds[0], fds[1] and fds[2]
+// as its stdin, stdout and stderr (a negative fd or NULL fds keeps the caller's one),
+// the callback is called from a helper thread when the run is over,
+// returns 0 or the error code if the run could not be started
+
+int
+jshell_run_config(const struct JShellScript *script, const int fds[3], const struct ExecutionConfig *config,
+                  jshell_callback callback, void *data);
+// like jshell_run, but with the options of executor.h (NULL for the defaults), which parse_options
+// of options.h can fill, the config is only read before the function returns
+
+void
+jshell_free(struct JShellScript *script);
+// frees up the handle, the runs already started are not affected
+
+#endif
@@ -4,24 +4,31 @@
 #include "syntax.h"
 #include "executor.h"
 #include "error_handler.h"
+#include "options.h"
 
 enum
 {
     INIT_STR_SIZE = 256
 };
 
+static struct ExecutionConfig config;
+
 void
 delete_all(void)
 {
     struct SuperStorage storage = saver(NULL);
     delete_expression_tree(storage.parsing_tree, &storage);
     free(storage.string);
+    free_options(&config);
 }
 
 int
-main(void)
+main(int argc, char **argv)
 {
     atexit(delete_all);
+    if (parse_options(argc, argv, &config)) {
+        exit(ERROR_EXIT);
+    }
     char *str = calloc(INIT_STR_SIZE, sizeof(*str));
     int c;
     long long idx = 0, str_len = INIT_STR_SIZE;
@@ -48,5 +55,5 @@ main(void)
 
     struct SuperStorage storage = syntax_analyse(str);
 
-    return start_execution(&storage);
+    return start_execution(&storage, &config);
 }
\ No newline at end of file
@@ -0,0 +1,404 @@
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <math.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/ioprio.h>
+#include "options.h"
+#include "executor.h"
+#include "error_handler.h"
+#include "syntax.h"
+
+enum
+{
+    IOPRIO_MAX_LEVEL = 7,
+    NICE_LIMIT = 40,
+    MAX_JOB_CPUS = 4096,
+    MAX_PARALLEL_WORKERS = 4096
+};
+
+enum OptionKey
+{
+    KEY_CPUS = 0x100,
+    KEY_NICE,
+    KEY_IONICE,
+    KEY_TRACE,
+    KEY_GROUP,
+    KEY_KEEP_ORDER,
+    KEY_GROUP_MEMORY,
+    KEY_MAP_WORKERS,
+    KEY_MAP_CHUNK,
+    KEY_JOB_TIMEOUT,
+    KEY_CGROUP_PARENT,
+    KEY_JOB_MEMORY,
+    KEY_JOB_CPU,
+    KEY_JOB_PIDS,
+    KEY_STATS,
+    KEY_JOURNAL,
+    KEY_RESUME,
+    KEY_PARALLEL,
+    KEY_PARALLEL_WORKERS
+};
+
+struct EnvOption
+{
+    const char *name;
+    enum OptionKey key;
+};
+// the environment variable that sets the same thing as the flag with the key
+
+static const struct option flags[] =
+{
+    {"cpus", required_argument, NULL, KEY_CPUS},
+    {"nice", required_argument, NULL, KEY_NICE},
+    {"ionice", required_argument, NULL, KEY_IONICE},
+    {"trace", no_argument, NULL, KEY_TRACE},
+    {"group", no_argument, NULL, KEY_GROUP},
+    {"keep-order", no_argument, NULL, KEY_KEEP_ORDER},
+    {"group-memory", required_argument, NULL, KEY_GROUP_MEMORY},
+    {"map-workers", required_argument, NULL, KEY_MAP_WORKERS},
+    {"map-chunk", required_argument, NULL, KEY_MAP_CHUNK},
+    {"job-timeout", required_argument, NULL, KEY_JOB_TIMEOUT},
+    {"cgroup-parent", required_argument, NULL, KEY_CGROUP_PARENT},
+    {"job-memory", required_argument, NULL, KEY_JOB_MEMORY},
+    {"job-cpu", required_argument, NULL, KEY_JOB_CPU},
+    {"job-pids", required_argument, NULL, KEY_JOB_PIDS},
+    {"stats", no_argument, NULL, KEY_STATS},
+    {"journal", required_argument, NULL, KEY_JOURNAL},
+    {"resume", no_argument, NULL, KEY_RESUME},
+    {"parallel", no_argument, NULL, KEY_PARALLEL},
+    {"parallel-workers", required_argument, NULL, KEY_PARALLEL_WORKERS},
+    {NULL, 0, NULL, 0}
+};
+
+static const struct EnvOption env_options[] =
+{
+    {"JSHELL_CPUS", KEY_CPUS},
+    {"JSHELL_NICE", KEY_NICE},
+    {"JSHELL_IONICE", KEY_IONICE},
+    {"JSHELL_TRACE", KEY_TRACE},
+    {"JSHELL_GROUP", KEY_GROUP},
+    {"JSHELL_KEEP_ORDER", KEY_KEEP_ORDER},
+    {"JSHELL_GROUP_MEMORY", KEY_GROUP_MEMORY},
+    {"JSHELL_MAP_WORKERS", KEY_MAP_WORKERS},
+    {"JSHELL_MAP_CHUNK", KEY_MAP_CHUNK},
+    {"JSHELL_JOB_TIMEOUT", KEY_JOB_TIMEOUT},
+    {"JSHELL_CGROUP_PARENT", KEY_CGROUP_PARENT},
+    {"JSHELL_JOB_MEMORY", KEY_JOB_MEMORY},
+    {"JSHELL_JOB_CPU", KEY_JOB_CPU},
+    {"JSHELL_JOB_PIDS", KEY_JOB_PIDS},
+    {"JSHELL_STATS", KEY_STATS},
+    {"JSHELL_JOURNAL", KEY_JOURNAL},
+    {"JSHELL_RESUME", KEY_RESUME},
+    {"JSHELL_PARALLEL", KEY_PARALLEL},
+    {"JSHELL_PARALLEL_WORKERS", KEY_PARALLEL_WORKERS},
+};
+
+static int
+apply_option(struct ExecutionConfig *config, enum OptionKey key, const char *value);
+// sets the option to the value, returns 0 if the value is valid
+
+static int
+parse_cpus(struct ExecutionConfig *config, const char *value);
+// parses a list like "0-3,8" or "all" (the CPUs the shell may run on)
+
+static int
+parse_ionice(struct ExecutionConfig *config, const char *value);
+// parses the I/O class as "CLASS[:LEVEL]", the class is a name or a number
+
+static int
+parse_number(const char *value, long min, long max, long *res);
+
+static int
+parse_size(const char *value, size_t *res);
+// parses an amount of bytes with an optional K, M or G suffix
+
+static int
+parse_switch(const char *value);
+// a flag without value or a variable set to anything but "" and "0" turns the option on
+
+static int
+parse_number(const char *value, long min, long max, long *res)
+{
+    char *end;
+    if (value == NULL || !*value) {
+        return 1;
+    }
+    *res = strtol(value, &end, 10);
+    return *end != '\0' || *res < min || *res > max;
+}
+
+static int
+parse_size(const char *value, size_t *res)
+{
+    char *end;
+    if (value == NULL || !isdigit(*value)) {
+        return 1;
+    }
+    unsigned long long size = strtoull(value, &end, 10);
+    int shift = 0;
+    switch (*end) {
+    case 'G':
+        shift += 10;
+    case 'M':
+        shift += 10;
+    case 'K':
+        shift += 10;
+        ++end;
+        break;
+    default:
+        break;
+    }
+    if (*end || size == 0 || size > (SIZE_MAX >> shift)) {
+        return 1;
+    }
+    *res = size << shift;
+    return 0;
+}
+
+int
+parse_duration(const char *value, long long *res)
+{
+    static const struct
+    {
+        const char *suffix;
+        double ms;
+    } units[] = {{"", 1000}, {"ms", 1}, {"s", 1000}, {"m", 60 * 1000}, {"h", 60 * 60 * 1000}, {"d", 24 * 60 * 60 * 1000}};
+    char *end;
+    if (value == NULL || !(isdigit(*value) || *value == '.')) {
+        return 1;
+    }
+    double amount = strtod(value, &end);
+    for (size_t i = 0; i < sizeof(units) / sizeof(*units); ++i) {
+        if (strcmp(end, units[i].suffix) == 0) {
+            double ms = ceil(amount * units[i].ms);
+            if (!(ms >= 1 && ms < (double) LLONG_MAX)) {
+                return 1;
+            }
+            *res = ms;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int
+parse_switch(const char *value)
+{
+    return value == NULL || (*value && strcmp(value, "0") != 0);
+}
+
+static int
+parse_cpus(struct ExecutionConfig *config, const char *value)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (strcmp(value, "all") == 0) {
+        if (sched_getaffinity(0, sizeof(set), &set) < 0) {
+            return 1;
+        }
+    } else {
+        const char *pos = value;
+        while (*pos) {
+            char *end;
+            long first = strtol(pos, &end, 10), last = first;
+            if (end == pos || first < 0 || first >= CPU_SETSIZE) {
+                return 1;
+            }
+            if (*end == '-') {
+                pos = end + 1;
+                last = strtol(pos, &end, 10);
+                if (end == pos || last < first || last >= CPU_SETSIZE) {
+                    return 1;
+                }
+            }
+            for (long cpu = first; cpu <= last; ++cpu) {
+                CPU_SET(cpu, &set);
+            }
+            if (*end == ',') {
+                ++end;
+            } else if (*end) {
+                return 1;
+            }
+            pos = end;
+        }
+    }
+    int count = CPU_COUNT(&set);
+    if (count == 0) {
+        return 1;
+    }
+    free(config->cpus);
+    config->cpus = calloc(count, sizeof(*config->cpus));
+    if (config->cpus == NULL) {
+        config->cpu_count = 0;
+        return 1;
+    }
+    config->cpu_count = 0;
+    for (int cpu = 0; config->cpu_count < count; ++cpu) {
+        if (CPU_ISSET(cpu, &set)) {
+            config->cpus[config->cpu_count++] = cpu;
+        }
+    }
+    return 0;
+}
+
+static int
+parse_ionice(struct ExecutionConfig *config, const char *value)
+{
+    static const char *const names[] = {"none", "realtime", "best-effort", "idle"};
+    long level = 0, io_class = -1;
+    size_t len = strcspn(value, ":");
+    for (size_t i = 1; i < sizeof(names) / sizeof(*names); ++i) {
+        if (strlen(names[i]) == len && strncmp(value, names[i], len) == 0) {
+            io_class = i;
+        }
+    }
+    if (io_class < 0) {
+        char *num = strndup(value, len);
+        int bad = parse_number(num, IOPRIO_CLASS_RT, IOPRIO_CLASS_IDLE, &io_class);
+        free(num);
+        if (bad) {
+            return 1;
+        }
+    }
+    if (value[len] == ':' && parse_number(value + len + 1, 0, IOPRIO_MAX_LEVEL, &level)) {
+        return 1;
+    }
+    config->ioprio_class = io_class;
+    config->ioprio_level = level;
+    return 0;
+}
+
+static int
+apply_option(struct ExecutionConfig *config, enum OptionKey key, const char *value)
+{
+    long num;
+    switch (key) {
+    case KEY_CPUS:
+        return parse_cpus(config, value);
+    case KEY_NICE:
+        if (parse_number(value, -NICE_LIMIT, NICE_LIMIT, &num)) {
+            return 1;
+        }
+        config->nice = num;
+        return 0;
+    case KEY_IONICE:
+        return parse_ionice(config, value);
+    case KEY_TRACE:
+        config->trace = parse_switch(value);
+        return 0;
+    case KEY_GROUP:
+        config->group = parse_switch(value);
+        return 0;
+    case KEY_KEEP_ORDER:
+        config->keep_order = parse_switch(value);
+        config->group |= config->keep_order;
+        return 0;
+    case KEY_GROUP_MEMORY:
+        return parse_size(value, &config->group_memory);
+    case KEY_MAP_WORKERS:
+        if (parse_number(value, 1, MAX_MAP_WORKERS, &num)) {
+            return 1;
+        }
+        config->map_workers = num;
+        return 0;
+    case KEY_MAP_CHUNK:
+        return parse_size(value, &config->map_chunk);
+    case KEY_JOB_TIMEOUT:
+        return parse_duration(value, &config->job_timeout);
+    case KEY_CGROUP_PARENT:
+        if (value == NULL || *value != '/') {
+            return 1;
+        }
+        config->cgroup_parent = value;
+        return 0;
+    case KEY_JOB_MEMORY:
+        return parse_size(value, &config->job_memory);
+    case KEY_JOB_CPU: {
+        char *end;
+        if (value == NULL || !(isdigit(*value) || *value == '.')) {
+            return 1;
+        }
+        config->job_cpu = strtod(value, &end);
+        return *end != '\0' || !(config->job_cpu > 0 && config->job_cpu <= MAX_JOB_CPUS);
+    }
+    case KEY_JOB_PIDS:
+        if (parse_number(value, 1, LONG_MAX, &num)) {
+            return 1;
+        }
+        config->job_pids = num;
+        return 0;
+    case KEY_STATS:
+        config->stats = parse_switch(value);
+        return 0;
+    case KEY_JOURNAL:
+        if (value == NULL || !*value) {
+            return 1;
+        }
+        config->journal = value;
+        return 0;
+    case KEY_RESUME:
+        config->resume = parse_switch(value);
+        return 0;
+    case KEY_PARALLEL:
+        config->parallel = parse_switch(value);
+        return 0;
+    case KEY_PARALLEL_WORKERS:
+        if (parse_number(value, 1, MAX_PARALLEL_WORKERS, &num)) {
+            return 1;
+        }
+        config->parallel_workers = num;
+        return 0;
+    default:
+        return 1;
+    }
+}
+
+int
+parse_options(int argc, char **argv, struct ExecutionConfig *config)
+{
+    for (size_t i = 0; i < sizeof(env_options) / sizeof(*env_options); ++i) {
+        const char *value = getenv(env_options[i].name);
+        if (value != NULL && apply_option(config, env_options[i].key, value)) {
+            fprintf(stderr, "Invalid value of %s: %s\n", env_options[i].name, value);
+            return ERROR_EXIT;
+        }
+    }
+    int key, idx;
+    while ((key = getopt_long(argc, argv, "", flags, &idx)) != -1) {
+        if (key == '?') {
+            return ERROR_EXIT;
+        }
+        if (apply_option(config, key, optarg)) {
+            fprintf(stderr, "Invalid value of --%s: %s\n", flags[idx].name, optarg);
+            return ERROR_EXIT;
+        }
+    }
+    if (optind < argc) {
+        fprintf(stderr, "Unexpected argument: %s\n", argv[optind]);
+        return ERROR_EXIT;
+    }
+    if (config->resume && config->journal == NULL) {
+        fprintf(stderr, "--resume needs a --journal to resume from\n");
+        return ERROR_EXIT;
+    }
+    // the journal runs the statements one by one, in their order
+    if (config->parallel && config->journal != NULL) {
+        fprintf(stderr, "--parallel can't be used with --journal\n");
+        return ERROR_EXIT;
+    }
+    return 0;
+}
+
+void
+free_options(struct ExecutionConfig *config)
+{
+    free(config->cpus);
+    config->cpus = NULL;
+    config->cpu_count = 0;
+}
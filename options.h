@@ -0,0 +1,21 @@
+#ifndef SHELL_OPTIONS_H
+#define SHELL_OPTIONS_H
+
+struct ExecutionConfig;
+
+int
+parse_options(int argc, char **argv, struct ExecutionConfig *config);
+// fills the config from the JSHELL_* environment variables and then from
+// the command line flags, returns 0 or prints the problem to stderr and
+// returns the error code
+
+int
+parse_duration(const char *value, long long *res);
+// parses a positive time like "10", "1.5s", "500ms", "2m", "1h" or "1d" (seconds by default)
+// into milliseconds, returns 0 if the value is valid
+
+void
+free_options(struct ExecutionConfig *config);
+// frees up the memory used by the config
+
+#endif
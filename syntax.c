@@ -1,9 +1,44 @@
 #include <ctype.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "syntax.h"
 #include "error_handler.h"
 
+enum
+{
+    PARALLEL_MIN_SIZE = 1 << 18,
+    PARALLEL_MIN_CHUNK = 1 << 15,
+    PARALLEL_CHUNKS_PER_THREAD = 4,
+    PARALLEL_MAX_THREADS = 64
+};
+// scripts shorter than PARALLEL_MIN_SIZE symbols are always parsed serially
+
+enum
+{
+    INIT_WORD = 16
+};
+// the initial size of the buffer a word is gathered in
+
+struct ParseChunk
+{
+    unsigned long long begin;
+    unsigned long long end;
+    struct ExpressionTree *tree;
+    int failed;
+};
+// a part of the script between two top-level newlines, end is the position of the newline
+
+struct ParsePool
+{
+    char *string;
+    struct ParseChunk *chunks;
+    size_t count;
+    size_t next;
+};
+// the chunks shared by the parsing threads, next is the first chunk nobody has taken yet
+
 static struct ExpressionTree *
 parse_seps(struct SuperStorage *storage);
 // parses separators, that means ";", "&" and end of line
@@ -31,6 +66,44 @@ parse_redirects(struct SuperStorage *storage, struct RedirectionHandle redirect)
 static void
 skip_spaces(struct SuperStorage *storage, int skip_endls);
 
+static void
+skip_blanks(struct SuperStorage *storage);
+// skips the spaces and the newlines
+
+static int
+is_keyword(struct SuperStorage *storage, const char *keyword);
+// checks if the word at the current position is the keyword
+
+static char *
+parse_word(struct SuperStorage *storage, struct ExpressionTree *owner);
+// parses a command's argument, the lists of "$(...)" in it are added to the owner's substs
+
+static struct ExpressionTree *
+parse_loop(struct SuperStorage *storage);
+// parses "while LIST; do LIST; done" and "for NAME in WORDS; do LIST; done"
+
+static int
+parse_parallel(struct SuperStorage *storage, size_t threads);
+// parses a big script by chunks on several threads and stitches them into one tree,
+// returns 0 if the script has to be parsed serially instead
+
+static size_t
+split_chunks(const char *str, size_t len, size_t target, struct ParseChunk **chunks);
+// finds top-level newlines at least target symbols apart, returns the amount of chunks
+
+static int
+starts_loop_word(const char *str, size_t pos, const char *keyword);
+// checks if the keyword stands as a separate word at the position where a command starts:
+// after a separator, a bracket or "do"
+
+static void *
+parse_chunks(void *arg);
+// the parsing thread: takes chunks from the pool until there are none left
+
+static struct ExpressionTree *
+stitch_chunks(struct ParseChunk *chunks, size_t count);
+// joins the chunk trees exactly as parse_seps joins the lines, NULL if it can't be done
+
 static void
 skip_spaces(struct SuperStorage *storage, int skip_endls)
 {
@@ -42,6 +115,81 @@ skip_spaces(struct SuperStorage *storage, int skip_endls)
     storage->position = auto_pos;
 }
 
+static void
+skip_blanks(struct SuperStorage *storage)
+{
+    while (isspace(storage->string[storage->position])) {
+        ++storage->position;
+    }
+}
+
+static int
+is_keyword(struct SuperStorage *storage, const char *keyword)
+{
+    size_t len = strlen(keyword);
+    char *pos = storage->string + storage->position;
+    if (strncmp(pos, keyword, len) != 0) {
+        return 0;
+    }
+    struct SuperStorage runner_storage = {.position = 0, .string = pos + len};
+    return isspace(pos[len]) || parse_op(&runner_storage) != INV_OP;
+}
+
+static char *
+parse_word(struct SuperStorage *storage, struct ExpressionTree *owner)
+{
+    skip_spaces(storage, 0);
+    size_t size = 0, cap = INIT_WORD;
+    char *word = malloc(cap);
+    if (word == NULL) {
+        set_error_number(storage, MEMORY_ERROR);
+        return NULL;
+    }
+    while (1) {
+        char *pos = storage->string + storage->position, symbol = *pos;
+        if (pos[0] == '$' && pos[1] == '(') {
+            // the list is parsed in place and the word keeps a mark instead of it
+            storage->position += 2;
+            struct ExpressionTree *subst = parse_seps(storage);
+            skip_spaces(storage, 0);
+            if (storage->container.err_happened || storage->string[storage->position] != ')') {
+                delete_expression_tree(subst, storage);
+                if (!storage->container.err_happened) {
+                    set_error_number(storage, BRACKETS_BALANCE);
+                }
+                break;
+            }
+            ++storage->position;
+            struct ExpressionTree **substs = realloc(owner->substs, (owner->subst_count + 1) * sizeof(*substs));
+            if (substs == NULL) {
+                delete_expression_tree(subst, storage);
+                set_error_number(storage, MEMORY_ERROR);
+                break;
+            }
+            owner->substs = substs;
+            owner->substs[owner->subst_count++] = subst;
+            symbol = SUBST_MARK;
+        } else {
+            struct SuperStorage runner_storage = {.position = 0, .string = pos};
+            if (parse_op(&runner_storage) != INV_OP || isspace(symbol)) {
+                break;
+            }
+            ++storage->position;
+        }
+        if (size + 2 > cap) {
+            char *tmp = realloc(word, cap <<= 1);
+            if (tmp == NULL) {
+                set_error_number(storage, MEMORY_ERROR);
+                break;
+            }
+            word = tmp;
+        }
+        word[size++] = symbol;
+    }
+    word[size] = '\0';
+    return word;
+}
+
 static enum Operation
 parse_op(struct SuperStorage *storage)
 {
@@ -63,6 +211,9 @@ parse_op(struct SuperStorage *storage)
         if (storage->string[storage->position + 1] == '|') {
             opcode = OP_DISJ;
             storage->position += 1;
+        } else if (storage->string[storage->position + 1] == '%') {
+            opcode = OP_MAP;
+            storage->position += 1;
         } else {
             opcode = OP_PIPE;
         }
@@ -109,16 +260,19 @@ parse_redirects(struct SuperStorage *storage, struct RedirectionHandle redirect)
         switch (next_op) {
         case OP_OUT:
             free(redirect.out.file);
+            redirect.out.file = NULL;
             redirect.out.exists = redirect.need_redirect = 1;
             curr_redirect = &(redirect.out);
             break;
         case OP_INP:
             free(redirect.in.file);
+            redirect.in.file = NULL;
             redirect.in.exists = redirect.need_redirect = 1;
             curr_redirect = &(redirect.in);
             break;
         case OP_APP:
             free(redirect.append.file);
+            redirect.append.file = NULL;
             redirect.append.exists = redirect.need_redirect = 1;
             curr_redirect = &(redirect.append);
             break;
@@ -150,11 +304,139 @@ parse_redirects(struct SuperStorage *storage, struct RedirectionHandle redirect)
     return redirect;
 }
 
+static struct ExpressionTree *
+parse_loop(struct SuperStorage *storage)
+{
+    struct ExpressionTree *res = calloc(1, sizeof(*res));
+    if (res == NULL) {
+        set_error_number(storage, MEMORY_ERROR);
+        return NULL;
+    }
+    if (is_keyword(storage, "while")) {
+        res->opcode = OP_WHILE;
+        storage->position += strlen("while");
+        res->left = parse_seps(storage);
+        if (res->left == NULL && !storage->container.err_happened) {
+            set_error_number(storage, NO_OPERAND);
+        }
+    } else {
+        res->opcode = OP_FOR;
+        storage->position += strlen("for");
+        res->argc = INIT_ARGC;
+        res->argv = calloc(res->argc, sizeof(*res->argv));
+        if (res->argv == NULL) {
+            res->argc = 0;
+            set_error_number(storage, MEMORY_ERROR);
+            delete_expression_tree(res, storage);
+            return NULL;
+        }
+        /*
+         * argv[0] is the name of the variable, the rest are the words,
+         * the last element is always kept for the terminating NULL.
+         */
+        skip_spaces(storage, 0);
+        unsigned long long prev_pos = storage->position;
+        if (parse_op(storage) != INV_OP) {
+            storage->position = prev_pos;
+            set_error_number(storage, NO_OPERAND);
+        } else {
+            storage->position = prev_pos;
+            res->argv[res->cur_argc++] = parse_word(storage, res);
+        }
+        if (!storage->container.err_happened) {
+            const char *name = res->argv[0];
+            int valid = isalpha(*name) || *name == '_';
+            for (; *name; ++name) {
+                valid &= isalnum(*name) || *name == '_';
+            }
+            if (!valid) {
+                storage->position = prev_pos;
+                set_error_number(storage, INVALID_OPERAND);
+            }
+        }
+        if (!storage->container.err_happened) {
+            skip_spaces(storage, 0);
+            if (is_keyword(storage, "in")) {
+                storage->position += strlen("in");
+            } else {
+                set_error_number(storage, LOOP_BALANCE);
+            }
+        }
+        while (!storage->container.err_happened) {
+            prev_pos = storage->position;
+            if (parse_op(storage) != INV_OP) {
+                storage->position = prev_pos;
+                break;
+            }
+            storage->position = prev_pos;
+            if (res->cur_argc + 1 == res->argc) {
+                char **argv = realloc(res->argv, (res->argc << 1) * sizeof(*res->argv));
+                if (argv == NULL) {
+                    set_error_number(storage, MEMORY_ERROR);
+                    break;
+                }
+                memset(argv + res->argc, 0, res->argc * sizeof(*argv));
+                res->argv = argv;
+                res->argc <<= 1;
+            }
+            res->argv[res->cur_argc++] = parse_word(storage, res);
+        }
+        if (!storage->container.err_happened) {
+            enum Operation op = parse_op(storage);
+            if (op != OP_SEMI && op != OP_ENDL) {
+                storage->position = prev_pos;
+                set_error_number(storage, LOOP_BALANCE);
+            }
+        }
+        res->argc = res->cur_argc;
+    }
+    if (storage->container.err_happened) {
+        delete_expression_tree(res, storage);
+        return NULL;
+    }
+
+    skip_blanks(storage);
+    if (!is_keyword(storage, "do")) {
+        set_error_number(storage, LOOP_BALANCE);
+        delete_expression_tree(res, storage);
+        return NULL;
+    }
+    storage->position += strlen("do");
+    skip_blanks(storage);
+    res->right = parse_seps(storage);
+    if (!storage->container.err_happened) {
+        skip_blanks(storage);
+        if (!is_keyword(storage, "done")) {
+            set_error_number(storage, LOOP_BALANCE);
+        } else if (res->right == NULL) {
+            set_error_number(storage, NO_OPERAND);
+        }
+    }
+    if (storage->container.err_happened) {
+        delete_expression_tree(res, storage);
+        return NULL;
+    }
+    storage->position += strlen("done");
+    res->redirect = parse_redirects(storage, res->redirect);
+    if (storage->container.err_happened) {
+        delete_expression_tree(res, storage);
+        return NULL;
+    }
+    return res;
+}
+
 static struct ExpressionTree *
 parse_command(struct SuperStorage *storage)
 {
     struct ExpressionTree *res;
     skip_spaces(storage, 0);
+    if (is_keyword(storage, "do") || is_keyword(storage, "done")) {
+        // the end of the loop's condition or body
+        return NULL;
+    }
+    if (is_keyword(storage, "while") || is_keyword(storage, "for")) {
+        return parse_loop(storage);
+    }
     if (storage->string[storage->position] == '(') {
         storage->position += 1;
         struct ExpressionTree *term_tree = parse_seps(storage);
@@ -225,15 +507,7 @@ parse_command(struct SuperStorage *storage)
                     return NULL;
                 }
             }
-            skip_spaces(storage, 0);
-            struct SuperStorage runner_storage = {.position = 0, .string = storage->string + storage->position};
-            while (parse_op(&runner_storage) == INV_OP && !isspace(*runner_storage.string)) {
-                runner_storage.position = 0;
-                ++runner_storage.string;
-            }
-            res->argv[res->cur_argc] = strndup(storage->string + storage->position,
-                                               runner_storage.string - storage->string - storage->position);
-            storage->position = runner_storage.string - storage->string;
+            res->argv[res->cur_argc] = parse_word(storage, res);
             res->redirect = parse_redirects(storage, res->redirect);
             if (storage->container.err_happened) {
                 delete_expression_tree(res, storage);
@@ -276,12 +550,38 @@ parse_pipe(struct SuperStorage *storage)
             set_error_number(storage, INVALID_OPERATION);
             return NULL;
         case OP_PIPE:
+        case OP_MAP:
             break;
         default:
             storage->position = prev_pos;
             return tree1;
         }
 
+        int unordered = 0;
+        long long workers = 0;
+        int has_workers = 0;
+        if (op == OP_MAP) {
+            // the error of a bad worker count is shown at "|%"
+            unsigned long long op_pos = storage->position - 2;
+            if (storage->string[storage->position] == '%') {
+                unordered = 1;
+                storage->position += 1;
+            }
+            while (isdigit(storage->string[storage->position])) {
+                has_workers = 1;
+                if (workers < MAX_MAP_WORKERS) {
+                    workers = workers * 10 + (storage->string[storage->position] - '0');
+                }
+                storage->position += 1;
+            }
+            if (workers > MAX_MAP_WORKERS || (has_workers && workers == 0)) {
+                storage->position = op_pos;
+                set_error_number(storage, INVALID_OPERATION);
+                delete_expression_tree(tree1, storage);
+                return NULL;
+            }
+        }
+
         struct ExpressionTree *tree2 = parse_command(storage);
         if (tree2 == NULL) {
             delete_expression_tree(tree1, storage);
@@ -299,6 +599,8 @@ parse_pipe(struct SuperStorage *storage)
         parent->left = tree1;
         parent->right = tree2;
         parent->opcode = op;
+        parent->workers = workers;
+        parent->unordered = unordered;
         tree1 = parent;
         storage->parsing_tree = tree1;
         prev_pos = storage->position;
@@ -419,29 +721,223 @@ saver(struct SuperStorage *storage)
     return keep;
 }
 
+static int
+starts_loop_word(const char *str, size_t pos, const char *keyword)
+{
+    size_t len = strlen(keyword), prev = pos;
+    while (prev > 0 && (str[prev - 1] == ' ' || str[prev - 1] == '\t')) {
+        --prev;
+    }
+    int after_do = prev >= 2 && strncmp(str + prev - 2, "do", 2) == 0 &&
+                   (prev == 2 || isspace(str[prev - 3]) || strchr(";&|(", str[prev - 3]));
+    if (prev > 0 && !strchr("\n;&|(", str[prev - 1]) && !after_do) {
+        return 0;
+    }
+    return strncmp(str + pos, keyword, len) == 0 &&
+           (str[pos + len] == '\0' || isspace(str[pos + len]) || strchr(";&|()<>", str[pos + len]));
+}
+
+static size_t
+split_chunks(const char *str, size_t len, size_t target, struct ParseChunk **chunks)
+{
+    /*
+     * The brackets are counted everywhere, the brackets inside of words too,
+     * and the loops from "while" or "for" to "done" where a command starts,
+     * so "echo done" doesn't close one. A newline at zero depth is taken for
+     * a separator of the top-level list. The scan is not a parser: where it
+     * splits a script wrongly, one of the chunks fails to parse or doesn't
+     * end where it should, and the whole script is parsed serially.
+     */
+    size_t count = 0, cap = len / target + 1;
+    *chunks = calloc(cap, sizeof(**chunks));
+    if (*chunks == NULL) {
+        return 0;
+    }
+    long long depth = 0;
+    unsigned long long begin = 0;
+    for (size_t i = 0; i < len && depth >= 0; ++i) {
+        if (str[i] == '(' || starts_loop_word(str, i, "while") || starts_loop_word(str, i, "for")) {
+            ++depth;
+        } else if (str[i] == ')' || starts_loop_word(str, i, "done")) {
+            --depth;
+        } else if (str[i] == '\n' && depth == 0 && i - begin >= target && count + 1 < cap) {
+            size_t next = i + 1;
+            while (str[next] == '\n') {
+                ++next;
+            }
+            if (str[next] == '\0') {
+                break;
+            }
+            (*chunks)[count].begin = begin;
+            (*chunks)[count++].end = i;
+            begin = i = next;
+            --i;
+        }
+    }
+    (*chunks)[count].begin = begin;
+    (*chunks)[count++].end = len;
+    return count;
+}
+
+static void *
+parse_chunks(void *arg)
+{
+    struct ParsePool *pool = arg;
+    size_t idx;
+    while ((idx = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < pool->count) {
+        struct ParseChunk *chunk = &pool->chunks[idx];
+        struct SuperStorage storage = {.string = pool->string, .position = chunk->begin};
+        chunk->tree = parse_seps(&storage);
+        if (!storage.container.err_happened) {
+            skip_spaces(&storage, 1);
+        }
+        // the chunk has to be parsed as a whole, otherwise the serial parser would stop inside it
+        if (storage.container.err_happened || chunk->tree == NULL || storage.position != chunk->end) {
+            delete_expression_tree(chunk->tree, &storage);
+            chunk->tree = NULL;
+            chunk->failed = 1;
+        }
+    }
+    return NULL;
+}
+
+static struct ExpressionTree *
+stitch_chunks(struct ParseChunk *chunks, size_t count)
+{
+    /*
+     * parse_seps makes each separator the parent of everything before it,
+     * so the first pipeline of a chunk becomes the right operand of the
+     * newline, whose left operand is the tree of all the previous chunks.
+     */
+    struct ExpressionTree *res = chunks[0].tree;
+    chunks[0].tree = NULL;
+    for (size_t i = 1; i < count; ++i) {
+        struct ExpressionTree *parent = NULL;
+        // if the previous chunk ends with a separator, the serial parser stops there
+        if ((res->opcode != OP_SEMI && res->opcode != OP_PARA && res->opcode != OP_ENDL) || res->right != NULL) {
+            parent = calloc(1, sizeof(*parent));
+        }
+        if (parent == NULL) {
+            struct SuperStorage storage = {};
+            delete_expression_tree(res, &storage);
+            return NULL;
+        }
+        struct ExpressionTree **first = &chunks[i].tree;
+        while ((*first)->opcode == OP_SEMI || (*first)->opcode == OP_PARA || (*first)->opcode == OP_ENDL) {
+            first = &(*first)->left;
+        }
+        parent->opcode = OP_ENDL;
+        parent->left = res;
+        parent->right = *first;
+        *first = parent;
+        res = chunks[i].tree;
+        chunks[i].tree = NULL;
+    }
+    return res;
+}
+
+static int
+parse_parallel(struct SuperStorage *storage, size_t threads)
+{
+    size_t len = strlen(storage->string);
+    size_t target = len / (threads * PARALLEL_CHUNKS_PER_THREAD);
+    if (target < PARALLEL_MIN_CHUNK) {
+        target = PARALLEL_MIN_CHUNK;
+    }
+    struct ParsePool pool = {.string = storage->string};
+    pool.count = split_chunks(storage->string, len, target, &pool.chunks);
+    if (pool.count < 2) {
+        free(pool.chunks);
+        return 0;
+    }
+    if (threads > pool.count) {
+        threads = pool.count;
+    }
+
+    // every chunk sees its closing newline as the end of the script
+    for (size_t i = 0; i + 1 < pool.count; ++i) {
+        storage->string[pool.chunks[i].end] = '\0';
+    }
+    pthread_t workers[PARALLEL_MAX_THREADS];
+    size_t started = 0;
+    while (started + 1 < threads && pthread_create(&workers[started], NULL, parse_chunks, &pool) == 0) {
+        ++started;
+    }
+    parse_chunks(&pool);
+    for (size_t i = 0; i < started; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+    for (size_t i = 0; i + 1 < pool.count; ++i) {
+        storage->string[pool.chunks[i].end] = '\n';
+    }
+
+    int failed = 0;
+    for (size_t i = 0; i < pool.count; ++i) {
+        failed |= pool.chunks[i].failed;
+    }
+    struct ExpressionTree *res = NULL;
+    if (!failed) {
+        res = stitch_chunks(pool.chunks, pool.count);
+    }
+    for (size_t i = 0; i < pool.count; ++i) {
+        delete_expression_tree(pool.chunks[i].tree, storage);
+    }
+    free(pool.chunks);
+    if (res == NULL) {
+        // the errors are reported by the serial parser, so their places are exactly the same
+        return 0;
+    }
+    storage->parsing_tree = res;
+    storage->position = len;
+    return 1;
+}
+
+int
+syntax_parse(struct SuperStorage *storage, char *str)
+{
+    storage->string = str;
+    storage->position = 0;
+    storage->container.err_happened = 0;
+    storage->container.place = NULL;
+
+    // JSHELL_PARSE_THREADS stands for the amount of CPUs, so that both parsers can be tested anywhere
+    const char *forced = getenv("JSHELL_PARSE_THREADS");
+    long threads = (forced != NULL && *forced) ? strtol(forced, NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > PARALLEL_MAX_THREADS) {
+        threads = PARALLEL_MAX_THREADS;
+    }
+    if (threads < 2 || strnlen(str, PARALLEL_MIN_SIZE) < PARALLEL_MIN_SIZE ||
+        !parse_parallel(storage, threads)) {
+        storage->position = 0;
+        storage->parsing_tree = parse_seps(storage);
+    }
+
+    if (!storage->container.err_happened) {
+        skip_spaces(storage, 1);
+        if (storage->string[storage->position] == ')') {
+            set_error_number(storage, BRACKETS_BALANCE);
+        } else if (storage->string[storage->position] != '\0') {
+            set_error_number(storage, INVALID_OPERATION);
+        }
+    }
+    if (storage->container.err_happened) {
+        delete_expression_tree(storage->parsing_tree, storage);
+        storage->parsing_tree = NULL;
+        return storage->container.code;
+    }
+    return 0;
+}
+
 struct SuperStorage
 syntax_analyse(char *str)
 {
     struct SuperStorage storage = {};
-    storage.string = str;
-    storage.position = 0;
-    storage.container.err_happened = 0;
-    storage.container.place = NULL;
-    storage.parsing_tree = parse_seps(&storage);
+    int code = syntax_parse(&storage, str);
 
     saver(&storage);
 
-    if (storage.container.err_happened) {
-        raise_error(storage.container.place, storage.container.code);
-    }
-
-    skip_spaces(&storage, 1);
-    if (storage.string[storage.position] != '\0') {
-        if (storage.string[storage.position] == ')') {
-            raise_error(storage.string + storage.position, BRACKETS_BALANCE);
-        } else {
-            raise_error(storage.string + storage.position, INVALID_OPERATION);
-        }
+    if (code) {
+        raise_error(storage.container.place, code);
     }
     return storage;
 }
@@ -449,8 +945,9 @@ syntax_analyse(char *str)
 void
 delete_expression_tree(struct ExpressionTree *parse_tree, struct SuperStorage *storage)
 {
-    if (parse_tree != NULL) {
-        delete_expression_tree(parse_tree->left, storage);
+    // the separators of a long script form a long left branch, so it is freed iteratively
+    while (parse_tree != NULL) {
+        struct ExpressionTree *left = parse_tree->left;
         delete_expression_tree(parse_tree->right, storage);
 
         if (parse_tree == storage->parsing_tree) {
@@ -463,8 +960,13 @@ delete_expression_tree(struct ExpressionTree *parse_tree, struct SuperStorage *s
         free(parse_tree->redirect.append.file);
         free(parse_tree->redirect.out.file);
         free(parse_tree->redirect.in.file);
+        for (long long i = 0; i < parse_tree->subst_count; ++i) {
+            delete_expression_tree(parse_tree->substs[i], storage);
+        }
+        free(parse_tree->substs);
 
         free(parse_tree->argv);
         free(parse_tree);
+        parse_tree = left;
     }
-}
\ No newline at end of file
+}
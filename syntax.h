@@ -12,12 +12,15 @@ enum Operation
     OP_SEMI, //";" symbol
     OP_ENDL, //end of line
     OP_PIPE, //pipeline
+    OP_MAP, //parallel map "|%", the stream is split by lines between several copies of the command
     OP_PARA, //parallel run, "&"
     OP_OUT, //redirection of output
     OP_APP, //redirection of output to append
     OP_INP, //redirection of input
     OP_LBR, //opening bracket
     OP_RBR, //closing bracket
+    OP_WHILE, //"while" loop, the condition is the left subtree and the body is the right one
+    OP_FOR, //"for" loop, argv holds the variable name and the words, the body is the right subtree
     INV_OP /*
  * invalid operation, used to determine the text entity,
  * that means the command name, arguments or a redirection file
@@ -30,6 +33,18 @@ enum
 };
 // the initial amount of a command's arguments
 
+enum
+{
+    SUBST_MARK = '\001'
+};
+// stands in a word for the next "$(...)" of the command, whose list is kept in substs
+
+enum
+{
+    MAX_MAP_WORKERS = 4096
+};
+// the most workers "|%" and --map-workers may ask for
+
 struct redirector
 {
     char *file;
@@ -53,7 +68,14 @@ struct ExpressionTree
     char **argv;
     long long argc;
     long long cur_argc;
+    long long workers;
+    int unordered;
+    struct ExpressionTree **substs;
+    long long subst_count;
 };
+// workers and unordered are the modifiers of "|%": "|%%" doesn't keep the order
+// of the outputs, a number after the operator is the amount of workers;
+// substs are the lists of "$(...)" in the words of a command or a "for" loop, in order
 
 struct SuperStorage
 {
@@ -70,6 +92,12 @@ delete_expression_tree(struct ExpressionTree *parse_tree, struct SuperStorage *s
 struct SuperStorage
 syntax_analyse(char *str);
 // analyses the given expression, converting it into tree
+// terminates the process if the expression is invalid
+
+int
+syntax_parse(struct SuperStorage *storage, char *str);
+// reentrant version of syntax_analyse: fills the storage and returns 0,
+// or returns the error code leaving the error place in storage->container
 
 struct SuperStorage
 saver(struct SuperStorage *storage);
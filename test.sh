@@ -3,7 +3,7 @@ TEST="tests_main/tests/test"
 ANS="tests_main/keys/test"
 TESTER=tests_main/tester
 MAIN=solution
-TESTS_AMOUNT=10
+TESTS_AMOUNT=22
 VALGRIND_FLAGS="--leak-check=full --show-leak-kinds=all --track-origins=yes --verbose"
 
 for i in $(seq 0 $TESTS_AMOUNT)
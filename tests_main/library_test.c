@@ -0,0 +1,131 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "jshell.h"
+#include "executor.h"
+
+/*
+ * Checks the interface of libjshell.a: parsing, the errors of parsing,
+ * the runs with the given descriptors and the exit codes passed to the callback.
+ * Prints the failed checks and exits with the amount of them.
+ */
+
+enum
+{
+    BUF_SIZE = 1024
+};
+
+static int failed;
+
+static int hook_pipe[2];
+// the atexit hook writes here, the children of the runs must never do it
+
+static void
+at_exit_hook(void);
+
+static void
+on_done(int status, void *data);
+// passes the exit code of the run through the pipe given as data
+
+static void
+check(int ok, const char *what);
+
+static int
+run_script(const char *text, const struct ExecutionConfig *config, char *out, size_t size);
+// runs the text with the output going to the buffer, returns the exit code passed to the callback
+
+static void
+at_exit_hook(void)
+{
+    if (write(hook_pipe[1], "x", 1) < 0) {
+        _exit(1);
+    }
+}
+
+static void
+on_done(int status, void *data)
+{
+    if (write(*(int *) data, &status, sizeof(status)) != sizeof(status)) {
+        _exit(1);
+    }
+}
+
+static void
+check(int ok, const char *what)
+{
+    if (!ok) {
+        fprintf(stderr, "Failed: %s\n", what);
+        ++failed;
+    }
+}
+
+static int
+run_script(const char *text, const struct ExecutionConfig *config, char *out, size_t size)
+{
+    struct JShellScript *script;
+    int output[2], done[2], status = -1;
+    if (jshell_parse(text, &script, NULL) != 0 || pipe2(output, O_CLOEXEC) < 0 || pipe2(done, O_CLOEXEC) < 0) {
+        return -1;
+    }
+    int fds[3] = {-1, output[1], -1};
+    if (jshell_run_config(script, fds, config, on_done, &done[1]) != 0) {
+        return -1;
+    }
+    close(output[1]);
+    size_t got = 0;
+    ssize_t ret;
+    while (got + 1 < size && (ret = read(output[0], out + got, size - got - 1)) > 0) {
+        got += ret;
+    }
+    out[got] = '\0';
+    if (read(done[0], &status, sizeof(status)) != sizeof(status)) {
+        status = -1;
+    }
+    close(output[0]);
+    close(done[0]);
+    close(done[1]);
+    jshell_free(script);
+    return status;
+}
+
+int
+main(void)
+{
+    if (pipe2(hook_pipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+        return 1;
+    }
+    atexit(at_exit_hook);
+
+    struct JShellScript *script;
+    struct JShellError error;
+    check(jshell_parse("echo hello | cat", &script, &error) == 0 && script != NULL, "parsing a valid line");
+    jshell_free(script);
+    check(jshell_parse("echo a | | b", &script, &error) == NO_OPERAND && script == NULL &&
+          error.code == NO_OPERAND && error.offset == 9, "the code and the offset of an error");
+    check(jshell_parse("(echo a", &script, &error) == BRACKETS_BALANCE && error.offset == 7,
+          "the offset of an unclosed bracket");
+
+    char out[BUF_SIZE];
+    check(run_script("echo hello; echo world | cat", NULL, out, sizeof(out)) == 0 &&
+          strcmp(out, "hello\nworld\n") == 0, "the output of a run");
+    check(run_script("true && false", NULL, out, sizeof(out)) == 1, "the exit code of a run");
+    // only the standard descriptors and the one of ls itself are open in the command
+    check(run_script("ls /proc/self/fd", NULL, out, sizeof(out)) == 0 && strcmp(out, "0\n1\n2\n3\n") == 0,
+          "the descriptors of the caller are closed");
+    check(run_script("(echo x); echo y > /dev/null; true | true; echo $(echo z)", NULL, out, sizeof(out)) == 0 &&
+          strcmp(out, "x\nz\n") == 0, "the output of the subshells");
+    char hooked;
+    check(read(hook_pipe[0], &hooked, 1) < 0, "the children don't run the atexit handlers");
+
+    struct ExecutionConfig config = {.keep_order = 1, .group = 1};
+    check(run_script("sleep 0.2 && echo first & echo second", &config, out, sizeof(out)) == 0 &&
+          strcmp(out, "first\nsecond\n") == 0, "a run with a config");
+
+    if (failed == 0) {
+        printf("OK!\n");
+    }
+    return failed;
+}
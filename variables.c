@@ -0,0 +1,171 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include "variables.h"
+#include "hash.h"
+
+enum
+{
+    INIT_CAPACITY = 64,
+    INIT_ENV_CAPACITY = 64
+};
+
+static struct Variable *
+find_slot(struct Variable *slots, size_t capacity, const char *name, size_t name_len);
+// returns the slot of the variable or the empty slot where it would be placed
+
+static int
+grow_table(struct VariableTable *table);
+// doubles the capacity of the table, keeping it at most half full
+
+static struct Variable *
+find_slot(struct Variable *slots, size_t capacity, const char *name, size_t name_len)
+{
+    size_t idx = hash_bytes(name, name_len) & (capacity - 1);
+    while (slots[idx].entry != NULL &&
+           (slots[idx].name_len != name_len || memcmp(slots[idx].entry, name, name_len) != 0)) {
+        idx = (idx + 1) & (capacity - 1);
+    }
+    return &slots[idx];
+}
+
+static int
+grow_table(struct VariableTable *table)
+{
+    size_t capacity = (table->capacity) ? table->capacity << 1 : INIT_CAPACITY;
+    struct Variable *slots = calloc(capacity, sizeof(*slots));
+    if (slots == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < table->capacity; ++i) {
+        if (table->slots[i].entry != NULL) {
+            *find_slot(slots, capacity, table->slots[i].entry, table->slots[i].name_len) = table->slots[i];
+        }
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->capacity = capacity;
+    return 0;
+}
+
+size_t
+variable_name_len(const char *str)
+{
+    if (!isalpha(*str) && *str != '_') {
+        return 0;
+    }
+    size_t len = 1;
+    while (isalnum(str[len]) || str[len] == '_') {
+        ++len;
+    }
+    return len;
+}
+
+int
+variables_init(struct VariableTable *table, char **environ_list)
+{
+    memset(table, 0, sizeof(*table));
+    table->envp = malloc(INIT_ENV_CAPACITY * sizeof(*table->envp));
+    if (table->envp == NULL || grow_table(table) < 0) {
+        return -1;
+    }
+    table->env_capacity = INIT_ENV_CAPACITY;
+    table->envp[0] = NULL;
+    for (char **env = environ_list; env != NULL && *env != NULL; ++env) {
+        const char *eq = strchr(*env, '=');
+        if (eq != NULL && variable_set(table, *env, eq - *env, eq + 1, 1) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+const char *
+variable_get(const struct VariableTable *table, const char *name, size_t name_len)
+{
+    if (table->capacity == 0) {
+        return NULL;
+    }
+    const struct Variable *var = find_slot(table->slots, table->capacity, name, name_len);
+    return (var->entry != NULL && var->env_idx != EXPORT_ON_SET) ? var->entry + name_len + 1 : NULL;
+}
+
+int
+variable_set(struct VariableTable *table, const char *name, size_t name_len, const char *value, int export)
+{
+    if ((table->count + 1) * 2 > table->capacity && grow_table(table) < 0) {
+        return -1;
+    }
+    size_t value_len = strlen(value);
+    char *entry = malloc(name_len + value_len + 2);
+    if (entry == NULL) {
+        return -1;
+    }
+    memcpy(entry, name, name_len);
+    entry[name_len] = '=';
+    memcpy(entry + name_len + 1, value, value_len + 1);
+
+    struct Variable *var = find_slot(table->slots, table->capacity, name, name_len);
+    if (var->entry == NULL) {
+        var->name_len = name_len;
+        var->env_idx = -1;
+        ++table->count;
+    }
+    free(var->entry);
+    var->entry = entry;
+    if (var->env_idx == EXPORT_ON_SET) {
+        var->env_idx = -1;
+        export = 1;
+    }
+    if (var->env_idx >= 0) {
+        table->envp[var->env_idx] = entry;
+    } else if (export) {
+        return variable_export(table, name, name_len);
+    }
+    return 0;
+}
+
+int
+variable_export(struct VariableTable *table, const char *name, size_t name_len)
+{
+    if ((table->count + 1) * 2 > table->capacity && grow_table(table) < 0) {
+        return -1;
+    }
+    struct Variable *var = find_slot(table->slots, table->capacity, name, name_len);
+    if (var->entry == NULL) {
+        if ((var->entry = strndup(name, name_len)) == NULL) {
+            return -1;
+        }
+        var->name_len = name_len;
+        var->env_idx = EXPORT_ON_SET;
+        ++table->count;
+        return 0;
+    }
+    if (var->env_idx >= 0 || var->env_idx == EXPORT_ON_SET) {
+        return 0;
+    }
+    if (table->env_count + 2 > table->env_capacity) {
+        size_t capacity = table->env_capacity << 1;
+        char **envp = realloc(table->envp, capacity * sizeof(*envp));
+        if (envp == NULL) {
+            return -1;
+        }
+        table->envp = envp;
+        table->env_capacity = capacity;
+    }
+    var->env_idx = table->env_count;
+    table->envp[table->env_count++] = var->entry;
+    table->envp[table->env_count] = NULL;
+    return 0;
+}
+
+void
+variables_free(struct VariableTable *table)
+{
+    for (size_t i = 0; i < table->capacity; ++i) {
+        free(table->slots[i].entry);
+    }
+    free(table->slots);
+    free(table->envp);
+    memset(table, 0, sizeof(*table));
+}
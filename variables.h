@@ -0,0 +1,68 @@
+#ifndef SHELL_VARIABLES_H
+#define SHELL_VARIABLES_H
+
+#include <stddef.h>
+
+struct Variable
+{
+    char *entry;
+    size_t name_len;
+    long long env_idx;
+};
+/*
+ * entry: "NAME=value", the value starts after the name and '=',
+ *     just "NAME" for a variable marked for export but not set yet,
+ *     NULL for an empty slot of the table
+ * env_idx: the index of the entry in envp, -1 if the variable is not exported,
+ *     EXPORT_ON_SET if it is marked for export but not set yet
+ */
+
+enum
+{
+    EXPORT_ON_SET = -2
+};
+
+struct VariableTable
+{
+    struct Variable *slots;
+    size_t capacity;
+    size_t count;
+    char **envp;
+    size_t env_count;
+    size_t env_capacity;
+};
+/*
+ * An open addressing hash table of the shell's variables. The envp array
+ * holds the entries of the exported variables and is kept up to date by
+ * every change, so it is passed to exec as it is. A forked child gets its
+ * own copy of the table with the pages shared until they are written, so
+ * the variables set for one command only change the child's copy.
+ */
+
+int
+variables_init(struct VariableTable *table, char **environ_list);
+// fills the table with the exported variables of the environment, returns 0 or -1 on error
+
+const char *
+variable_get(const struct VariableTable *table, const char *name, size_t name_len);
+// returns the value of the variable, NULL if it is not set
+
+int
+variable_set(struct VariableTable *table, const char *name, size_t name_len, const char *value, int export);
+// sets the variable, exporting it if export isn't 0 (an exported one stays exported),
+// returns 0 or -1 on error
+
+int
+variable_export(struct VariableTable *table, const char *name, size_t name_len);
+// exports the variable, an unset one is only marked and enters envp once it is set,
+// returns 0 or -1 on error
+
+size_t
+variable_name_len(const char *str);
+// returns the length of the variable name the string starts with, 0 if it doesn't start with one
+
+void
+variables_free(struct VariableTable *table);
+// frees up the memory used by the table
+
+#endif